@@ -26,10 +26,12 @@ def quantize_weights(weights, min_val, max_val):
 
 # Generate random weights for W_res
 W_res = np.random.uniform(-1, 1, (num_neu_res, num_neu_res)) * 0.1
-# sparsity = 0.3
-# mask = np.random.rand(num_neu_res, num_neu_res) > sparsity
-# W_res = W_res[mask]
-# np.fill_diagonal(W_res, 0)
+# Fraction of W_res synapses removed, 0.0 keeps the reservoir fully connected
+sparsity = 0.0
+if sparsity > 0:
+    mask = np.random.rand(num_neu_res, num_neu_res) >= sparsity
+    W_res = W_res * mask
+    np.fill_diagonal(W_res, 0)
 rho_W_res = max(abs(np.linalg.eigvals(W_res)))
 
 # Calculate in_scale for W_in
@@ -120,6 +122,18 @@ core_parameters = {
     "PTE_times": 4,
     "PTE_range": 1,
     "ET_N": 15,
+    "active_set": False,                                        # step only reservoir neurons reached by a spike, pays off with a sparse (CSR) W_res
+    "W_res_format": "auto",                                     # dense, sparse or auto (by density)
+    "sparse_threshold": 0.3,                                    # auto picks CSR at or below this W_res density
+    "precision": "double",                                      # double, float or fixed (int16 potentials, int8 weights)
+    "train_mode": "DFA",                                        # DFA, FA or NONE (output layer only)
+    "train_phase": False,                                       # phasic training with PTE_*
+    "eligibility_trace": False,                                 # replay reservoir spikes for ET_N ticks
+    "refractory": True,                                         # refractory period of t_ref
+    "num_threads": 4,                                           # threads of the run loop, 0 for the OpenMP default
+    "thread_pinning": False,                                    # pin each thread to one CPU
+    "parallel_min_work": 16384,                                 # steps with fewer synaptic updates run on one thread
+    "early_stop_margin": 0,                                     # inference stops when the top class leads by this many output spikes, 0 is off
 }
 
 # Define the system parameters dictionary
@@ -129,7 +143,13 @@ system_parameters = {
     "lr": 0.004,                                                # same as conductance steps. This is for 8bits ~ 1/250.
     "test_file": "../tools/speech-to-spikes/gen_spike/test.bin",    # Replace with the actual test file path
     "training_file": "../tools/speech-to-spikes/gen_spike/train",   # Replace with the actual training file path
+    "training_file_ext": ".bin",                                # training chunk i is training_file + i + ext, ".smsd" for converted files
     "N_chunks": 10,                             # you can devide training dataset as 'chunk'
+    "batch_size": 1,                                            # samples trained in parallel on one weight snapshot, 1 is sequential
+    "parallel_test": True,                                      # evaluate test samples in parallel, one core copy per thread
+    "lockstep_batch": 1,                                        # test samples advanced together per thread (Batch_core), 1 is off
+    "prefetch_depth": 8,                                        # samples decoded ahead of the sequential simulation, 0 decodes the whole file first
+    "loader_threads": 1,                                        # threads decoding the prefetched samples
 }
 
 # Combine system and core parameters into a single dictionary
@@ -0,0 +1,39 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Allocator for arrays walked by the propagation kernels, aligned to a cache line
+template <typename T, std::size_t Align = 64>
+struct Aligned_allocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = Aligned_allocator<U, Align>; };
+
+    Aligned_allocator() noexcept = default;
+    template <typename U>
+    Aligned_allocator(const Aligned_allocator<U, Align>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+
+    void deallocate(T* p, std::size_t) noexcept {
+        ::operator delete(p, std::align_val_t(Align));
+    }
+
+    template <typename U>
+    bool operator==(const Aligned_allocator<U, Align>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const Aligned_allocator<U, Align>&) const noexcept { return false; }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, Aligned_allocator<T>>;
+
+#endif // ALIGNED_ALLOCATOR_H
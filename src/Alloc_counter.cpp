@@ -0,0 +1,36 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#include "Alloc_counter.h"
+
+#ifdef DEBUG
+#include <cstdlib>
+#include <new>
+
+namespace {
+thread_local size_t n_allocations = 0;
+}
+
+// Replaced global allocation functions, the aligned forms are left alone (only used for the
+// buffers sized by the Core constructors)
+void* operator new(std::size_t size) {
+    ++n_allocations;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+size_t thread_allocations() {
+    return n_allocations;
+}
+#else
+size_t thread_allocations() {
+    return 0;
+}
+#endif
@@ -0,0 +1,12 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstddef>
+
+// Heap allocations (global operator new) made so far by the calling thread.
+// Counted in debug builds only (make debug), always 0 otherwise.
+size_t thread_allocations();
+
+#endif // ALLOC_COUNTER_H
@@ -0,0 +1,257 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#include "Batch_core.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+// I[j][b] += w[j] * m[b] for the n postsynaptic neurons of one weight row, m is non-zero on `cols`.
+// Few samples on a row are added column by column, many as a dense rows x batch product.
+template <typename Acc, typename Weight>
+inline void accumulate_row_batch(Acc* I, const Weight* w, const Acc* m, size_t n, size_t batch, const std::vector<uint32_t>& cols) {
+    if (cols.size() * 2 < batch) {
+        for (uint32_t b : cols) {
+            Acc mb = m[b];
+            for (size_t j = 0; j < n; ++j) I[j * batch + b] += static_cast<Acc>(w[j]) * mb;
+        }
+        return;
+    }
+    for (size_t j = 0; j < n; ++j) {
+        Acc wj = static_cast<Acc>(w[j]);
+        Acc* row = I + j * batch;
+        for (size_t b = 0; b < batch; ++b) row[b] += wj * m[b];
+    }
+}
+
+} // namespace
+
+template <typename State, typename Weight>
+Batch_core<State, Weight>::Batch_core(const Core<State, Weight>& core, size_t batch_size)
+    : core(core), batch(batch_size), N_in(core.N_in), N_res(core.Neu_res.size()), N_out(core.Neu_out.size()), N_class(core.Neu_acc.size()) {
+    if (batch == 0) {
+        throw std::runtime_error("Batch size cannot be zero");
+    }
+    if (core.N_out_times == 0) {
+        throw std::runtime_error("N_out_times cannot be zero");
+    }
+    class_label.assign(batch, 0);
+    correct.assign(batch, 0);
+    external_S_train.resize(batch);
+    internal_S_queue = Delay_wheel<uint32_t>(core.t_delay, 1);
+    active.assign(batch, 0);
+    decided.assign(batch, 0);
+    decision_time.assign(batch, 0);
+    T_last.assign(batch, 0);
+
+    V_res.resize(N_res * batch);
+    V_out.resize(N_out * batch);
+    V_frac_res.resize(traits::is_fixed ? N_res * batch : 0);
+    V_frac_out.resize(traits::is_fixed ? N_out * batch : 0);
+    T_ref_res.resize(N_res * batch);
+    T_ref_out.resize(N_out * batch);
+    I_res.assign(N_res * batch, acc_t(0));
+    I_out.assign(N_out * batch, acc_t(0));
+
+    in_count.assign(N_in * batch, acc_t(0));
+    mask.assign(batch, acc_t(0));
+    decay_res.resize(core.Neu_res.tau_values.size() * batch);
+    decay_out.resize(core.Neu_out.tau_values.size() * batch);
+    Neu_acc.resize(batch * N_class);
+    reset();
+}
+
+template <typename State, typename Weight>
+void Batch_core<State, Weight>::reset() {
+    for (auto& train : external_S_train) train.clear();
+    internal_S_queue.clear();
+    std::fill(T_last.begin(), T_last.end(), 0);
+    std::fill(V_res.begin(), V_res.end(), core.Neu_res.V_reset);
+    std::fill(V_out.begin(), V_out.end(), core.Neu_out.V_reset);
+    std::fill(V_frac_res.begin(), V_frac_res.end(), 0);
+    std::fill(V_frac_out.begin(), V_frac_out.end(), 0);
+    std::fill(T_ref_res.begin(), T_ref_res.end(), 0);
+    std::fill(T_ref_out.begin(), T_ref_out.end(), 0);
+    std::fill(Neu_acc.begin(), Neu_acc.end(), 0);
+    std::fill(correct.begin(), correct.end(), 0);
+    std::fill(decided.begin(), decided.end(), 0);
+    std::fill(decision_time.begin(), decision_time.end(), 0);
+}
+
+template <typename State, typename Weight>
+void Batch_core<State, Weight>::load_spike_train(size_t b, const std::vector<uint32_t>& spike_times, const std::vector<uint16_t>& neuron_indices) {
+    external_S_train[b].load(spike_times, neuron_indices);
+}
+
+template <typename State, typename Weight>
+void Batch_core<State, Weight>::load_spike_train(size_t b, const Spike_train_view& train) {
+    external_S_train[b].load(train);
+}
+
+// Leak the samples stepped at T_now, idle samples get factor 1 and are left unchanged, so a
+// batch with many samples stepped is leaked branch-free over the whole row
+template <typename State, typename Weight>
+void Batch_core<State, Weight>::leak(const Neuron_population<State>& neu, std::vector<decay_t>& factors, State* V, uint16_t* V_frac, size_t n, uint32_t T_now) {
+    for (size_t c = 0; c < neu.tau_values.size(); ++c) {
+        for (size_t b = 0; b < batch; ++b) {
+            double f = active[b] ? neu.decay(static_cast<uint16_t>(c), T_now - T_last[b]) : 1.0;
+            factors[c * batch + b] = traits::decay_factor(f);
+        }
+    }
+    bool dense = active_list.size() * 2 >= batch;
+    for (size_t i = 0; i < n; ++i) {
+        const decay_t* f = &factors[neu.tau_class[i] * batch];
+        State* v = V + i * batch;
+        if constexpr (traits::is_fixed) {
+            uint16_t* r = V_frac + i * batch;
+            if (dense) {
+                for (size_t b = 0; b < batch; ++b) v[b] = traits::decay(v[b], r[b], f[b]);
+            } else {
+                for (uint32_t b : active_list) v[b] = traits::decay(v[b], r[b], f[b]);
+            }
+        } else if (dense) {
+            for (size_t b = 0; b < batch; ++b) v[b] = traits::decay(v[b], f[b]);
+        } else {
+            for (uint32_t b : active_list) v[b] = traits::decay(v[b], f[b]);
+        }
+    }
+}
+
+// Apply and clear the summed input, then fire and reset the neurons of the stepped samples.
+// Reservoir spikes go to the delay queue, output spikes are counted per class.
+template <typename State, typename Weight>
+template <bool Refractory>
+void Batch_core<State, Weight>::in_fire(const Neuron_population<State>& neu, State* V, uint16_t* V_frac, uint32_t* T_ref, acc_t* I, size_t n, uint32_t T_now, bool output) {
+    // idle samples have no input
+    for (size_t i = 0; i < n; ++i) {
+        for (uint32_t b : active_list) {
+            size_t k = i * batch + b;
+            acc_t input = I[k];
+            if constexpr (Refractory) {
+                input = (T_now < T_ref[k]) ? acc_t(0) : input;
+            }
+            V[k] = traits::saturate(std::max(static_cast<acc_t>(V[k]) + input, static_cast<acc_t>(neu.V_bot)));
+            I[k] = 0;
+        }
+        for (uint32_t b : active_list) {
+            size_t k = i * batch + b;
+            if (V[k] < neu.V_th) continue;
+            if (output) {
+                ++Neu_acc[b * N_class + i / core.N_out_times];
+            } else {
+                internal_S_queue.push(0, T_now + core.t_delay, static_cast<uint32_t>(k));
+            }
+            V[k] = neu.V_reset;
+            if constexpr (traits::is_fixed) V_frac[k] = 0;
+            if constexpr (Refractory) {
+                T_ref[k] = T_now + neu.t_ref;
+            }
+        }
+    }
+}
+
+template <typename State, typename Weight>
+void Batch_core<State, Weight>::run() {
+    const uint32_t T_sim = core.T_sim;
+
+    while (true) {
+        uint32_t T_now = internal_S_queue.empty() ? T_sim + 1 : internal_S_queue.next_time();
+        for (const auto& train : external_S_train) {
+            if (!train.empty()) T_now = std::min(T_now, train.next_time());
+        }
+        if (T_now > T_sim) break;
+
+        // Samples with an event at this tick and their input spikes, indices from N_in on are 'b' side and not propagated
+        std::fill(active.begin(), active.end(), 0);
+        for (size_t b = 0; b < batch; ++b) {
+            Spike_input& train = external_S_train[b];
+            if (train.empty() || train.next_time() > T_now) continue;
+            active[b] = 1;
+            std::pair<size_t, size_t> in_frame = train.advance(T_now);
+            for (size_t k = in_frame.first; k < in_frame.second; ++k) {
+                uint16_t id_now = train.ids[k];
+                if (id_now < N_in) in_count[id_now * batch + b] += 1;
+            }
+        }
+        S_vec_now.clear();
+        internal_S_queue.drain(T_now, S_vec_now);
+        if (core.early_stop_margin > 0) {
+            S_vec_now.erase(std::remove_if(S_vec_now.begin(), S_vec_now.end(), [&](uint32_t s) { return decided[s % batch] != 0; }), S_vec_now.end());
+        }
+        for (uint32_t s : S_vec_now) active[s % batch] = 1;
+        active_list.clear();
+        for (size_t b = 0; b < batch; ++b) {
+            if (active[b]) active_list.push_back(static_cast<uint32_t>(b));
+        }
+
+        leak(core.Neu_res, decay_res, V_res.data(), V_frac_res.data(), N_res, T_now);
+        leak(core.Neu_out, decay_out, V_out.data(), V_frac_out.data(), N_out, T_now);
+        for (size_t b = 0; b < batch; ++b) {
+            if (active[b]) T_last[b] = T_now;
+        }
+
+        // One pass over each weight row for every sample that spiked on it
+        for (size_t id_now = 0; id_now < N_in; ++id_now) {
+            acc_t* m = &in_count[id_now * batch];
+            cols.clear();
+            for (uint32_t b : active_list) {
+                if (m[b] != 0) cols.push_back(b);
+            }
+            if (cols.empty()) continue;
+            accumulate_row_batch(I_res.data(), core.W_in[id_now].data(), m, N_res, batch, cols);
+            for (uint32_t b : cols) m[b] = 0;
+        }
+
+        // reservoir spikes of a tick come out of the queue grouped by neuron
+        for (size_t k = 0; k < S_vec_now.size();) {
+            size_t id_now = S_vec_now[k] / batch;
+            cols.clear();
+            for (; k < S_vec_now.size() && S_vec_now[k] / batch == id_now; ++k) {
+                uint32_t b = S_vec_now[k] % batch;
+                if (mask[b] == 0) cols.push_back(b);
+                mask[b] += 1;
+            }
+
+            if (core.W_res_sparse) {
+                const auto& csr = core.W_res_csr;
+                for (uint32_t e = csr.row_ptr[id_now]; e < csr.row_ptr[id_now + 1]; ++e) {
+                    acc_t w = static_cast<acc_t>(csr.val[e]);
+                    acc_t* row = &I_res[csr.col_idx[e] * batch];
+                    for (uint32_t b : cols) row[b] += w * mask[b];
+                }
+            } else {
+                accumulate_row_batch(I_res.data(), core.W_res[id_now].data(), mask.data(), N_res, batch, cols);
+            }
+            accumulate_row_batch(I_out.data(), core.W_out[id_now].data(), mask.data(), N_out, batch, cols);
+            for (uint32_t b : cols) mask[b] = 0;
+        }
+
+        if (core.refractory) {
+            in_fire<true>(core.Neu_res, V_res.data(), V_frac_res.data(), T_ref_res.data(), I_res.data(), N_res, T_now, false);
+            in_fire<true>(core.Neu_out, V_out.data(), V_frac_out.data(), T_ref_out.data(), I_out.data(), N_out, T_now, true);
+        } else {
+            in_fire<false>(core.Neu_res, V_res.data(), V_frac_res.data(), T_ref_res.data(), I_res.data(), N_res, T_now, false);
+            in_fire<false>(core.Neu_out, V_out.data(), V_frac_out.data(), T_ref_out.data(), I_out.data(), N_out, T_now, true);
+        }
+
+        // a decided sample takes no more input and its pending spikes are dropped
+        for (uint32_t b : active_list) {
+            decision_time[b] = T_now;
+            auto acc = Neu_acc.begin() + b * N_class;
+            if (core.early_stop_margin > 0 && output_margin(acc, acc + N_class) >= core.early_stop_margin) {
+                decided[b] = 1;
+                external_S_train[b].clear();
+            }
+        }
+    }
+
+    for (size_t b = 0; b < batch; ++b) {
+        auto acc = Neu_acc.begin() + b * N_class;
+        uint8_t max_index = std::distance(acc, std::max_element(acc, acc + N_class));
+        correct[b] = (max_index == class_label[b]);
+    }
+}
+
+template class Batch_core<double, double>;
+template class Batch_core<float, float>;
+template class Batch_core<int16_t, int8_t>;
@@ -0,0 +1,75 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#ifndef BATCH_CORE_H
+#define BATCH_CORE_H
+
+#include <cstdint>
+#include <vector>
+#include "Core.h"
+#include "Spike.h"
+#include "Delay_wheel.h"
+#include "Aligned_allocator.h"
+#include "Scalar_traits.h"
+
+// Lockstep inference of a batch of samples on the weights of a Core.
+// The samples share one tick axis: a tick steps every sample with an event at that time, and the
+// state is laid out [neuron][batch], so the weight row of a presynaptic neuron is read once per tick
+// and added to every sample that spiked on it (a small dense product rows x batch).
+// Each sample is stepped on its own ticks as Core does with active_set off, so a sample gives the
+// spikes of Core::run without training up to the summation order of the inputs of a tick.
+// The Core is only read and must outlive the batch.
+template <typename State, typename Weight>
+class Batch_core {
+public:
+    using traits = Scalar_traits<State>;
+    using acc_t = typename traits::acc_t;
+    using decay_t = typename traits::decay_t;
+
+    Batch_core(const Core<State, Weight>& core, size_t batch_size);
+
+    size_t size() const { return batch; }
+
+    // Clear every sample of the batch, unloaded samples stay idle
+    void reset();
+    void load_spike_train(size_t b, const std::vector<uint32_t>& spike_times, const std::vector<uint16_t>& neuron_indices);
+    void load_spike_train(size_t b, const Spike_train_view& train);
+
+    // Run every sample to T_sim (or its early decision, see Core::early_stop_margin),
+    // correct[b] tells whether sample b was classified as class_label[b]
+    void run();
+
+    std::vector<uint8_t> class_label;
+    std::vector<uint8_t> correct;
+    std::vector<uint32_t> decision_time;        // time of the last step of each sample
+
+private:
+    const Core<State, Weight>& core;
+    size_t batch;
+    size_t N_in, N_res, N_out, N_class;     // N_in inputs propagate, higher input indices are 'b' side
+
+    std::vector<Spike_input> external_S_train;  // per sample
+    Delay_wheel<uint32_t> internal_S_queue;     // reservoir spikes as i * batch + b
+    std::vector<uint32_t> S_vec_now;
+    std::vector<uint32_t> T_last;               // per sample, every neuron of a sample is stepped on its ticks
+    std::vector<uint8_t> active;                // samples stepped at this tick
+    std::vector<uint8_t> decided;               // samples stopped early
+    std::vector<uint32_t> active_list;
+    std::vector<uint32_t> cols;                 // samples with spikes on the current weight row
+
+    // [neuron][batch]
+    aligned_vector<State> V_res, V_out;
+    aligned_vector<uint16_t> V_frac_res, V_frac_out;   // fixed point only, see Neuron_population::V_frac
+    aligned_vector<uint32_t> T_ref_res, T_ref_out;
+    aligned_vector<acc_t> I_res, I_out;
+
+    aligned_vector<acc_t> in_count;             // [input][batch], input spikes of this tick
+    aligned_vector<acc_t> mask;                 // [batch], samples spiking on the current row
+    std::vector<decay_t> decay_res, decay_out;  // [tau class][batch], factor 1 for idle samples
+    std::vector<uint32_t> Neu_acc;              // [batch][class]
+
+    void leak(const Neuron_population<State>& neu, std::vector<decay_t>& factors, State* V, uint16_t* V_frac, size_t n, uint32_t T_now);
+    template <bool Refractory>
+    void in_fire(const Neuron_population<State>& neu, State* V, uint16_t* V_frac, uint32_t* T_ref, acc_t* I, size_t n, uint32_t T_now, bool output);
+};
+
+#endif // BATCH_CORE_H
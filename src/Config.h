@@ -3,6 +3,7 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <string>
 #include <vector>
 
 struct Config {
@@ -18,9 +19,7 @@ struct Config {
     double V_th;
     double V_bot;
     double V_reset;
-#if defined(REFRACTORY)
     double t_ref;
-#endif
     double SG_window;
 
     int N_in;
@@ -34,6 +33,24 @@ struct Config {
     size_t PTE_slide;
     size_t PTE_times;
     size_t PTE_range;
+
+    bool active_set = false;    // step only the reservoir neurons reached by a spike
+    std::string W_res_format = "auto";  // "dense", "sparse" or "auto" (sparse if density <= sparse_threshold)
+    double sparse_threshold = 0.3;
+
+    // Modes of the run loop, see Train_policy
+    std::string train_mode = "DFA";     // "DFA", "FA" or "NONE" (output layer only)
+    bool train_phase = false;
+    bool eligibility_trace = false;
+    bool refractory = true;
+
+    // Threading of the run loop
+    int num_threads = 0;                // 0: OpenMP default (OMP_NUM_THREADS)
+    bool thread_pinning = false;        // pin each thread of the team to one CPU
+    size_t parallel_min_work = 16384;   // smaller steps (synaptic updates) run on one thread
+
+    // Inference stops once the leading class has this many more output spikes than the next one, 0: off
+    size_t early_stop_margin = 0;
 };
 
 #endif // CONFIG_H
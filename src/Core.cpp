@@ -2,6 +2,8 @@
 // SPDX-License-Identifier: Apache-2.0
 #include "Core.h"
 #include "Config.h"
+#include "Kernels.h"
+#include "Alloc_counter.h"
 #include <fstream>
 #include <iostream>
 #include <algorithm>
@@ -10,11 +12,119 @@
 #include <omp.h>
 #include <vector>
 #include <thread>
+#include <numeric>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 using json = nlohmann::json;
 
+namespace {
+
+// Weight matrices are stored in the weight format of the core and read/written in real units
+template <typename Weight>
+std::vector<std::vector<Weight>> from_real_matrix(const std::vector<std::vector<double>>& m) {
+    std::vector<std::vector<Weight>> out(m.size());
+    for (size_t i = 0; i < m.size(); ++i) {
+        out[i].reserve(m[i].size());
+        for (double w : m[i]) out[i].push_back(Scalar_traits<Weight>::from_real(w));
+    }
+    return out;
+}
+
+template <typename Weight>
+std::vector<std::vector<double>> to_real_matrix(const std::vector<std::vector<Weight>>& m) {
+    std::vector<std::vector<double>> out(m.size());
+    for (size_t i = 0; i < m.size(); ++i) {
+        out[i].reserve(m[i].size());
+        for (Weight w : m[i]) out[i].push_back(Scalar_traits<Weight>::to_real(w));
+    }
+    return out;
+}
+
+// Apply a net count of n steps to one synapse, clamped once to clip in the direction of n. The
+// counts are sums over a step or a batch and may mix signs (feedback counts add up fb_sign), so
+// this is the net update. For counts of one sign it equals n clamped single steps in a row, the
+// clamp being monotone.
+template <typename Weight>
+inline void apply_steps(Weight& w, int32_t n, Weight step, Weight clip) {
+    using acc_t = typename Scalar_traits<Weight>::acc_t;
+    if (n == 0) return;
+    acc_t v = static_cast<acc_t>(w) + static_cast<acc_t>(n) * static_cast<acc_t>(step);
+    w = static_cast<Weight>(n > 0 ? std::min<acc_t>(v, clip) : std::max<acc_t>(v, -static_cast<acc_t>(clip)));
+}
+
+// Slot of the CPU a thread is pinned to by pin_thread, SIZE_MAX while it runs on its own mask
+thread_local size_t pinned_slot = SIZE_MAX;
+
+// Pin the calling thread to the k-th CPU it is allowed to run on, k being its thread number over
+// all enclosing parallel regions, so the one-thread cores of an outer sample loop spread over the
+// CPUs by their outer thread. A pooled thread is moved again when it comes back with another k.
+inline void pin_thread() {
+#if defined(__linux__)
+    size_t k = 0;
+    for (int level = 1; level <= omp_get_level(); ++level) {
+        k = k * static_cast<size_t>(omp_get_team_size(level)) + static_cast<size_t>(omp_get_ancestor_thread_num(level));
+    }
+    if (pinned_slot == k) return;
+    // CPUs allowed before any thread was pinned, a pinned thread only sees its own
+    static const cpu_set_t allowed = [] {
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) CPU_ZERO(&set);
+        return set;
+    }();
+    pinned_slot = k;
+    int n_cpus = CPU_COUNT(&allowed);
+    if (n_cpus == 0) return;
+    size_t nth_cpu = k % n_cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (nth_cpu-- == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            return;
+        }
+    }
+#endif
+}
+
+// Gives the calling thread its CPU mask back when the run loop leaves, the thread that runs the
+// loop is the master of the team and is pinned with it. Threads it starts later, like the sample
+// loaders, inherit its mask and would otherwise share its one CPU.
+class Affinity_guard {
+public:
+    explicit Affinity_guard(bool enabled) : saved(false) {
+#if defined(__linux__)
+        saved = enabled && pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+#else
+        (void)enabled;
+#endif
+    }
+    ~Affinity_guard() {
+#if defined(__linux__)
+        if (!saved) return;
+        pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+        pinned_slot = SIZE_MAX;
+#endif
+    }
+    Affinity_guard(const Affinity_guard&) = delete;
+    Affinity_guard& operator=(const Affinity_guard&) = delete;
+
+private:
+    bool saved;
+#if defined(__linux__)
+    cpu_set_t mask;
+#endif
+};
+
+} // namespace
+
 // Core constructor with distributed tau values
-Core::Core(const std::string& param_file, const std::string& weights_file, const std::vector<int>& tau_values) {
+template <typename State, typename Weight>
+Core<State, Weight>::Core(const std::string& param_file, const std::string& weights_file, const std::vector<int>& tau_values) {
 
     std::cout << "Parameter file path: " << param_file << std::endl;
     std::cout << "Weights file path: " << weights_file << std::endl;
@@ -36,9 +146,7 @@ Core::Core(const std::string& param_file, const std::string& weights_file, const
     config.V_bot = param_json["core_parameter"]["V_bot"].get<double>();
     config.V_reset = param_json["core_parameter"]["V_reset"].get<double>();
     config.SG_window = param_json["core_parameter"]["SG_window"].get<double>();
-#if defined(REFRACTORY)
     config.t_ref = param_json["core_parameter"]["t_ref"].get<uint32_t>();
-#endif
     config.N_in = param_json["core_parameter"]["N_in"].get<int>();
     config.N_res = param_json["core_parameter"]["N_res"].get<int>();
     config.N_out = param_json["core_parameter"]["N_out"].get<int>();
@@ -50,6 +158,17 @@ Core::Core(const std::string& param_file, const std::string& weights_file, const
     config.PTE_times = param_json["core_parameter"]["PTE_times"].get<uint32_t>();
     config.PTE_range = param_json["core_parameter"]["PTE_range"].get<uint32_t>();
     config.ET_N = param_json["core_parameter"]["ET_N"].get<uint32_t>();
+    config.active_set = param_json["core_parameter"].value("active_set", false);
+    config.W_res_format = param_json["core_parameter"].value("W_res_format", std::string("auto"));
+    config.sparse_threshold = param_json["core_parameter"].value("sparse_threshold", 0.3);
+    config.train_mode = param_json["core_parameter"].value("train_mode", std::string("DFA"));
+    config.train_phase = param_json["core_parameter"].value("train_phase", false);
+    config.eligibility_trace = param_json["core_parameter"].value("eligibility_trace", false);
+    config.refractory = param_json["core_parameter"].value("refractory", true);
+    config.num_threads = param_json["core_parameter"].value("num_threads", 0);
+    config.thread_pinning = param_json["core_parameter"].value("thread_pinning", false);
+    config.parallel_min_work = param_json["core_parameter"].value("parallel_min_work", size_t(16384));
+    config.early_stop_margin = param_json["core_parameter"].value("early_stop_margin", size_t(0));
 
     /*
     // Print the loaded values
@@ -60,9 +179,7 @@ Core::Core(const std::string& param_file, const std::string& weights_file, const
     std::cout << "V_bot: " << config.V_bot << std::endl;
     std::cout << "V_reset: " << config.V_reset << std::endl;
     std::cout << "SG_window: " << config.SG_window << std::endl;
-    #if defined(REFRACTORY)
     std::cout << "t_ref: " << config.t_ref << std::endl;
-    #endif
     std::cout << "N_in: " << config.N_in << std::endl;
     std::cout << "N_res: " << config.N_res << std::endl;
     std::cout << "N_out: " << config.N_out << std::endl;
@@ -99,30 +216,15 @@ Core::Core(const std::string& param_file, const std::string& weights_file, const
 
 
 // Core constructor with configuration and tau values
-Core::Core(const Config& config, const std::vector<int>& tau_values)
-    : W_in(config.W_in), W_res(config.W_res), W_out(config.W_out), W_fb(config.W_fb), W_bias(config.W_bias), T_sim(config.T_sim), t_delay(config.t_delay) {
+template <typename State, typename Weight>
+Core<State, Weight>::Core(const Config& config, const std::vector<int>& tau_values)
+    : T_sim(config.T_sim), W_in(from_real_matrix<Weight>(config.W_in)), W_res(from_real_matrix<Weight>(config.W_res)), W_out(from_real_matrix<Weight>(config.W_out)), W_bias(from_real_matrix<Weight>(config.W_bias)), N_in(W_in.size()), W_fb(config.W_fb), t_delay(config.t_delay) {
 
-#if defined(REFRACTORY)
-    Neu_res.reserve(config.N_res);
-    for (int i = 0; i < config.N_res; ++i) {
-        Neu_res.emplace_back(config.V_init, tau_values[i], config.V_th, config.V_bot, config.V_reset, config.t_ref, config.SG_window);
-    }
-
-    Neu_out.reserve(config.N_out);
-    for (int i = 0; i < config.N_out; ++i) {
-        Neu_out.emplace_back(config.V_init, config.tau_out, config.V_th, config.V_bot, config.V_reset, config.t_ref, config.SG_window);
-    }
-#else
-    Neu_res.reserve(config.N_res);
-    for (int i = 0; i < config.N_res; ++i) {
-        Neu_res.emplace_back(config.V_init, tau_values[i], config.V_th, config.V_bot, config.V_reset, config.SG_window);
-    }
-
-    Neu_out.reserve(config.N_out);
-    for (int i = 0; i < config.N_out; ++i) {
-        Neu_out.emplace_back(config.V_init, config.tau_out, config.V_th, config.V_bot, config.V_reset, config.SG_window);
-    }
-#endif
+    uint32_t t_ref = config.t_ref;
+    std::vector<double> tau_res(tau_values.begin(), tau_values.begin() + config.N_res);
+    std::vector<double> tau_out(config.N_out, config.tau_out);
+    Neu_res = Neuron_population<State>(tau_res, config.V_init, config.V_th, config.V_bot, config.V_reset, t_ref, config.SG_window);
+    Neu_out = Neuron_population<State>(tau_out, config.V_init, config.V_th, config.V_bot, config.V_reset, t_ref, config.SG_window);
 
     Neu_acc.resize(config.N_class, 0);
     N_out_times = config.N_out_times;
@@ -132,6 +234,61 @@ Core::Core(const Config& config, const std::vector<int>& tau_values)
     PTE_range = config.PTE_range;
     ET_N = config.ET_N;
 
+    if (static_cast<size_t>(config.N_res) > Spike::max_index) {
+        throw std::runtime_error("N_res does not fit the spike index");
+    }
+    // Delayed traffic is due at most t_delay ticks after it is sent
+    internal_S_queue = Delay_wheel<Spike>(t_delay, 1);
+    fb_pre_queue = Delay_wheel<uint32_t>(t_delay, 1);
+    fb_post_queue = Delay_wheel<uint32_t>(t_delay, 1);
+
+    // Training and neuron modes
+    train_phase = config.train_phase;
+    bool flags[3] = {config.train_phase, config.eligibility_trace, config.refractory};
+    switch (parse_train_rule(config.train_mode)) {
+        case Train_rule::DFA: run_loop_fn = select_run_loop<Train_rule::DFA>(flags); break;
+        case Train_rule::FA: run_loop_fn = select_run_loop<Train_rule::FA>(flags); break;
+        case Train_rule::NONE: run_loop_fn = select_run_loop<Train_rule::NONE>(flags); break;
+    }
+
+    refractory = config.refractory;
+    early_stop_margin = config.early_stop_margin;
+    num_threads = config.num_threads;
+    thread_pinning = config.thread_pinning;
+    parallel_min_work = config.parallel_min_work;
+
+    // With decay toward zero an untouched neuron never climbs to V_th, as long as it starts below it
+    active_set = config.active_set;
+    if (active_set && !(config.V_th > 0 && config.V_reset < config.V_th && config.V_init < config.V_th)) {
+        std::cout << "active_set needs 0 < V_th, V_reset < V_th and V_init < V_th, stepping every neuron" << std::endl;
+        active_set = false;
+    }
+    Neu_res_all.resize(Neu_res.size());
+    std::iota(Neu_res_all.begin(), Neu_res_all.end(), 0);
+    Neu_res_active.reserve(Neu_res.size());
+    Neu_res_touched.assign(Neu_res.size(), 0);
+    I_res.assign(Neu_res.size(), acc_t(0));
+    I_out.assign(Neu_out.size(), acc_t(0));
+    out_sign.assign(Neu_out.size(), 0);
+    out_sign_trace.assign(Neu_out.size(), 0);
+
+    // Reservoir weights: CSR when sparse enough, dense rows otherwise
+    double W_res_density = Sparse_matrix<Weight>::density(W_res);
+    if (config.W_res_format == "sparse") {
+        W_res_sparse = true;
+    } else if (config.W_res_format == "dense") {
+        W_res_sparse = false;
+    } else if (config.W_res_format == "auto") {
+        W_res_sparse = W_res_density <= config.sparse_threshold;
+    } else {
+        throw std::runtime_error("Unknown W_res_format: " + config.W_res_format);
+    }
+    if (W_res_sparse) {
+        W_res_csr = Sparse_matrix<Weight>(W_res);
+        W_res.clear();
+        W_res.shrink_to_fit();
+    }
+
     /*
     // Check the initialized states of Neu_res, Neu_out
     std::cout << "Neu_res size: " << Neu_res.size() << std::endl;
@@ -150,100 +307,156 @@ Core::Core(const Config& config, const std::vector<int>& tau_values)
     std::cout << "PTE_times: " << PTE_times<< std::endl;
     std::cout << "PTE_range: " << PTE_range << std::endl;
     std::cout << "ET_N: " << ET_N<< std::endl;
+    std::cout << "train_mode: " << config.train_mode << ", train_phase: " << config.train_phase
+              << ", eligibility_trace: " << config.eligibility_trace << ", refractory: " << config.refractory << std::endl;
+    std::cout << "active_set: " << active_set << std::endl;
+    std::cout << "early_stop_margin: " << early_stop_margin << std::endl;
+    std::cout << "num_threads: " << num_threads << ", thread_pinning: " << thread_pinning << ", parallel_min_work: " << parallel_min_work << std::endl;
+    std::cout << "W_res density: " << W_res_density << (W_res_sparse ? " (sparse)" : " (dense)") << std::endl;
+    std::cout << "propagation kernel: " << kernel_isa() << std::endl;
 
 }
 
 // Copy constructor
-Core::Core(const Core& other)
-    : W_in(other.W_in), W_res(other.W_res), W_out(other.W_out), W_fb(other.W_fb), W_bias(other.W_bias), T_sim(other.T_sim), t_delay(other.t_delay), Neu_res(other.Neu_res), Neu_out(other.Neu_out), Neu_acc(other.Neu_acc), external_S_queue(other.external_S_queue), internal_S_queue(other.internal_S_queue), S_vec_now(other.S_vec_now), N_out_times(other.N_out_times), enabling_train(other.enabling_train), class_label(other.class_label), lr(other.lr) {
+template <typename State, typename Weight>
+Core<State, Weight>::Core(const Core& other)
+    : enabling_train(other.enabling_train), T_sim(other.T_sim), class_label(other.class_label), ET_N(other.ET_N), PTE_times(other.PTE_times), PTE_slide(other.PTE_slide), PTE_range(other.PTE_range), lr(other.lr), train_phase(other.train_phase), num_threads(other.num_threads), early_stop_margin(other.early_stop_margin), decision_time(other.decision_time), run_loop_fn(other.run_loop_fn), thread_pinning(other.thread_pinning), refractory(other.refractory), parallel_min_work(other.parallel_min_work), W_in(other.W_in), W_res(other.W_res), W_out(other.W_out), W_bias(other.W_bias), N_in(other.N_in), W_fb(other.W_fb), W_res_csr(other.W_res_csr), W_res_sparse(other.W_res_sparse), Neu_res(other.Neu_res), Neu_out(other.Neu_out), Neu_acc(other.Neu_acc), external_S_train(other.external_S_train), internal_S_queue(other.internal_S_queue), trace_fired(other.trace_fired), trace_head(other.trace_head), T_trace(other.T_trace), S_vec_now(other.S_vec_now), fb_pre_queue(other.fb_pre_queue), fb_post_queue(other.fb_post_queue), t_delay(other.t_delay), N_out_times(other.N_out_times), active_set(other.active_set), Neu_res_all(other.Neu_res_all), Neu_res_active(other.Neu_res_active), Neu_res_touched(other.Neu_res_touched), I_res(other.I_res), I_out(other.I_out), out_sign(other.out_sign), out_sign_trace(other.out_sign_trace), fb_sign(other.fb_sign), defer_updates(other.defer_updates), dW_out(other.dW_out), dW_res(other.dW_res) {
 }
 
 // Assignment operator
-Core& Core::operator=(const Core& other) {
+template <typename State, typename Weight>
+Core<State, Weight>& Core<State, Weight>::operator=(const Core& other) {
     if (this != &other) {
         W_in = other.W_in;
+        N_in = other.N_in;
         W_res = other.W_res;
         W_out = other.W_out;
         W_fb = other.W_fb;
         W_bias = other.W_bias;
+        W_res_csr = other.W_res_csr;
+        W_res_sparse = other.W_res_sparse;
         T_sim = other.T_sim;
         t_delay = other.t_delay;
         Neu_res = other.Neu_res;
         Neu_out = other.Neu_out;
         Neu_bias = other.Neu_bias;
         Neu_acc = other.Neu_acc;
-        external_S_queue = other.external_S_queue;
+        external_S_train = other.external_S_train;
         internal_S_queue = other.internal_S_queue;
+        trace_fired = other.trace_fired;
+        trace_head = other.trace_head;
+        T_trace = other.T_trace;
         S_vec_now = other.S_vec_now;
+        fb_pre_queue = other.fb_pre_queue;
+        fb_post_queue = other.fb_post_queue;
         N_out_times = other.N_out_times;
+        active_set = other.active_set;
+        Neu_res_all = other.Neu_res_all;
+        Neu_res_active = other.Neu_res_active;
+        Neu_res_touched = other.Neu_res_touched;
+        I_res = other.I_res;
+        I_out = other.I_out;
         enabling_train = other.enabling_train;
         class_label = other.class_label;
+        ET_N = other.ET_N;
+        PTE_times = other.PTE_times;
+        PTE_slide = other.PTE_slide;
+        PTE_range = other.PTE_range;
         lr = other.lr;
+        train_phase = other.train_phase;
+        run_loop_fn = other.run_loop_fn;
+        early_stop_margin = other.early_stop_margin;
+        decision_time = other.decision_time;
+        num_threads = other.num_threads;
+        thread_pinning = other.thread_pinning;
+        refractory = other.refractory;
+        parallel_min_work = other.parallel_min_work;
+        defer_updates = other.defer_updates;
+        out_sign = other.out_sign;
+        out_sign_trace = other.out_sign_trace;
+        fb_sign = other.fb_sign;
+        dW_out = other.dW_out;
+        dW_res = other.dW_res;
     }
     return *this;
 }
 
-// Reset the core
-void Core::reset() {
-    /*
-    for (auto& neuron : Neu_res) {
-#if defined(REFRACTORY)
-        neuron = Neuron(neuron.get_V_mem(), neuron.get_tau(), neuron.get_V_th(), neuron.get_V_bot(), neuron.get_V_reset(), neuron.get_t_ref(), neuron.get_SG_window());
-#else
-        neuron = Neuron(neuron.get_V_mem(), neuron.get_tau(), neuron.get_V_th(), neuron.get_V_bot(), neuron.get_V_reset(), neuron.get_SG_window());
-#endif
-        }
-
-    for (auto& neuron : Neu_out) {
-#if defined(REFRACTORY)
-        neuron = Neuron(neuron.get_V_mem(), neuron.get_tau(), neuron.get_V_th(), neuron.get_V_bot(), neuron.get_V_reset(), neuron.get_t_ref(), neuron.get_SG_window());
-#else
-        neuron = Neuron(neuron.get_V_mem(), neuron.get_tau(), neuron.get_V_th(), neuron.get_V_bot(), neuron.get_V_reset(), neuron.get_SG_window());
-#endif
-    }*/
-
-    /**/
-    for (size_t i = 0; i < Neu_res.size(); ++i) {
-        Neu_res[i].reset();
-        Neu_res[i].reset_ref();
-    }
-
-    for (size_t i = 0; i < Neu_out.size(); ++i) {
-        Neu_out[i].reset();
-        Neu_out[i].reset_ref();
-    }
-
-
-    while (!external_S_queue.empty()) {
-        external_S_queue.pop();
+// Keep the learning steps of each synapse instead of applying them after every step (mini-batch training).
+// The counts only take memory while deferred updates are on.
+template <typename State, typename Weight>
+void Core<State, Weight>::set_deferred_updates(bool on) {
+    defer_updates = on;
+    if (!on) {
+        dW_out = Update_accumulator();
+        dW_res = Update_accumulator();
     }
+}
 
-    while (!internal_S_queue.empty()) {
-        internal_S_queue.pop();
-    }
+// Add the step counts of other to this core's and clear them in other.
+// Counts are integers, so the sum does not depend on the order of the cores.
+template <typename State, typename Weight>
+void Core<State, Weight>::add_deferred_updates(Core& other) {
+    dW_out.merge(other.dW_out);
+    dW_res.merge(other.dW_res);
+}
 
-    while (!Event_queue.empty()) {
-        Event_queue.pop();
+template <typename State, typename Weight>
+Weight Core<State, Weight>::learning_step() const {
+    Weight w_step = Scalar_traits<Weight>::from_real(lr * 0.1);
+    if (lr != 0 && w_step == Weight(0)) {
+        throw std::runtime_error("lr " + std::to_string(lr) + " rounds to a zero weight step in this precision");
     }
+    return w_step;
+}
 
-    while (!Event_queue_delay.empty()) {
-        Event_queue_delay.pop();
-    }
+// Apply the counted steps to the weights once and clear the counts
+template <typename State, typename Weight>
+void Core<State, Weight>::apply_deferred_updates() {
+    const Weight w_step = learning_step();
+    const Weight w_clip = Scalar_traits<Weight>::from_real(0.1);
+    dW_out.apply(0, dW_out.size(), [&](uint64_t k, int32_t steps) {
+        apply_steps(W_out[k / Neu_out.size()][k % Neu_out.size()], steps, w_step, w_clip);
+    });
+    // keys of a sparse reservoir are CSR positions
+    dW_res.apply(0, dW_res.size(), [&](uint64_t k, int32_t steps) {
+        Weight& w = W_res_sparse ? W_res_csr.val[k] : W_res[k / Neu_res.size()][k % Neu_res.size()];
+        apply_steps(w, steps, w_step, w_clip);
+    });
+    dW_out.clear();
+    dW_res.clear();
+}
 
-    while (!S_vec_trace.empty()) {
-        S_vec_trace.pop();
-    }
+// Take the trainable weights of other (the snapshot of a batch)
+template <typename State, typename Weight>
+void Core<State, Weight>::copy_weights(const Core& other) {
+    W_out = other.W_out;
+    W_res = other.W_res;
+    W_res_csr.val = other.W_res_csr.val;
+}
 
-    while (!S_vec_trace_delay.empty()) {
-        S_vec_trace_delay.pop();
-    }
+// Reset the core
+// The neuron state is refilled in bulk, the delay wheels start a new generation (constant time)
+template <typename State, typename Weight>
+void Core<State, Weight>::reset() {
+    Neu_res.reset_all();
+    Neu_out.reset_all();
+
+    external_S_train.clear();
+    internal_S_queue.clear();
+    fb_pre_queue.clear();
+    fb_post_queue.clear();
+    trace_fired.clear();
+    trace_head = 0;
+    T_trace = 0;
 
     S_vec_now.clear();
-    Neu_acc.assign(Neu_acc.size(), 0);  // Reset the size of Neu_acc based on the current number of classes
+    std::fill(Neu_acc.begin(), Neu_acc.end(), 0);
+    decision_time = 0;
 }
 
 // Save recorded spikes to a file
-void Core::save_recorded_spikes(const std::string& filename) {
+template <typename State, typename Weight>
+void Core<State, Weight>::save_recorded_spikes(const std::string& filename) {
     std::ofstream file(filename, std::ios::binary);
     if (!file.is_open()) {
         throw std::runtime_error("Could not open binary file for saving recorded spikes");
@@ -258,489 +471,528 @@ void Core::save_recorded_spikes(const std::string& filename) {
 }
 
 // Run the simulation
-bool Core::run() {
-    return run_loop();
+template <typename State, typename Weight>
+bool Core<State, Weight>::run() {
+    return (this->*run_loop_fn)();
 }
 
-// Run the simulation loop
-bool Core::run_loop() {
-
-    omp_set_num_threads(4);
-
-    uint32_t T_now = 0;
-    size_t class_now = static_cast<size_t>(class_label);
-    size_t train_signal;
-
-    while (T_now <= T_sim) {
-        // if (internal_S_queue.empty()) break;
-        uint32_t T_external = external_S_queue.empty() ? T_sim + 1 : external_S_queue.top().time;
-        uint32_t T_internal = internal_S_queue.empty() ? T_sim + 1 : internal_S_queue.top().time;
-        T_now = std::min(T_external, T_internal);
-
-        // std::cout << T_now << std::endl;
-
-        if (T_now > T_sim) break;
-
-        while (!external_S_queue.empty() && external_S_queue.top().time <= T_now) {
-            S_vec_now.push_back(external_S_queue.top());
-            external_S_queue.pop();
-        }
-
-        while (!internal_S_queue.empty() && internal_S_queue.top().time <= T_now) {
-            S_vec_now.push_back(internal_S_queue.top());
-            internal_S_queue.pop();
-        }
-
-        if (N_out_times == 0) {
-            throw std::runtime_error("N_out_times cannot be zero");
-        }
-
-        train_index = static_cast<size_t>(static_cast<size_t>(T_now) % N_out_times);
-        train_signal = 0;
+// Run loop of one mode combination, picked at runtime: Flags are filled in from
+// {train_phase, eligibility_trace, refractory} one at a time
+template <typename State, typename Weight>
+template <Train_rule Rule, bool... Flags>
+typename Core<State, Weight>::Run_loop Core<State, Weight>::select_run_loop(const bool* flags) {
+    if constexpr (sizeof...(Flags) == 3) {
+        return &Core::run_loop<Train_policy<Rule, Flags...>>;
+    } else {
+        return flags[sizeof...(Flags)] ? select_run_loop<Rule, Flags..., true>(flags)
+                                       : select_run_loop<Rule, Flags..., false>(flags);
+    }
+}
 
-#if defined(TRAIN_PHASE)
+// Run the simulation loop.
+// One thread team lives for the whole sample. Each step starts with a serial part on one thread
+// (begin_step), then either the team runs it (run_step, reservoir split in neuron blocks) or, when
+// the step has less than parallel_min_work synaptic updates, the same thread runs it alone.
+template <typename State, typename Weight>
+template <typename Policy>
+bool Core<State, Weight>::run_loop() {
+    size_t n_threads = num_threads > 0 ? static_cast<size_t>(num_threads) : static_cast<size_t>(omp_get_max_threads());
+
+    // one lane per thread for lock-free pushes into the delay wheels
+    internal_S_queue.reserve_lanes(n_threads);
+    fb_post_queue.reserve_lanes(n_threads);
+    reserve_buffers<Policy>();
+
+    // checked here, nothing may throw inside the parallel region
+    if (N_out_times == 0) {
+        throw std::runtime_error("N_out_times cannot be zero");
+    }
+    if constexpr (Policy::phase) {
         if (PTE_times == 0) {
             throw std::runtime_error("N_training_times cannot be zero");
         }
         if (PTE_range == 0) {
             throw std::runtime_error("PTE_range cannot be zero");
         }
+    }
 
-        // std::cout << "PTE_slide: " << PTE_slide << ", PTE_times: " << PTE_times << ", PTE_range: " << PTE_range << std::endl;
-        train_signal = static_cast<size_t>(((static_cast<size_t>(T_now) + PTE_range * PTE_slide) / PTE_range) % PTE_times);
-#endif
-
-        // Parallelize the leak method for Neu_res and Neu_out
-        #pragma omp parallel
-        {
-            #pragma omp for schedule(static)
-            for (size_t i = 0; i < Neu_res.size(); ++i) {
-                Neu_res[i].leak(T_now);
-            }
-
-            #pragma omp for schedule(static)
-            for (size_t i = 0; i < Neu_out.size(); ++i) {
-                Neu_out[i].leak(T_now);
+    // learning step and weight clamp in the weight format
+    const Weight w_step = learning_step();
+    const Weight w_clip = Scalar_traits<Weight>::from_real(0.1);
+
+    // the flags alternate between two slots: a thread may still read those of a step while the
+    // thread of the next single writes the next ones, but it cannot fall further behind
+    Step step{};
+    bool done[2] = {false, false};
+    bool parallel_step[2] = {false, false};
+    size_t loop_allocations = 0;
+    Affinity_guard affinity(thread_pinning);
+    #pragma omp parallel num_threads(n_threads) if(n_threads > 1)
+    {
+        size_t tid = omp_get_thread_num();
+        size_t nth = omp_get_num_threads();
+        if (thread_pinning) pin_thread();
+        size_t allocations = thread_allocations();
+
+        for (size_t k = 0; ; k ^= 1) {
+            #pragma omp single
+            {
+                done[k] = !begin_step<Policy>(step);
+                parallel_step[k] = !done[k] && nth > 1 && step.work >= parallel_min_work;
+                if (!done[k] && !parallel_step[k]) run_step<Policy>(step, 0, 1, w_step, w_clip);
             }
+            if (done[k]) break;
+            if (parallel_step[k]) run_step<Policy>(step, tid, nth, w_step, w_clip);
         }
+        #pragma omp atomic
+        loop_allocations += thread_allocations() - allocations;
+    }
+#ifdef DEBUG
+    // the buffers only grow past their reserved size, e.g. with many learning events
+    if (loop_allocations > 0) {
+        std::cerr << "run_loop: " << loop_allocations << " heap allocations" << std::endl;
+    }
+#else
+    (void)loop_allocations;
+#endif
 
-        // std::cout << "leaky is OKAY " << std::endl;
+    if constexpr (Policy::phase) {
+        PTE_slide = static_cast<size_t>((PTE_slide + 1) % PTE_times);
+    }
+    // train_index = (train_index + 1) % N_out_times;
 
-        // Parallelize spike propagation
-        #pragma omp parallel for
-        for (size_t i = 0; i < S_vec_now.size(); ++i) {
-            const auto& S_now = S_vec_now[i];
-            int id_now = S_now.id.first;
-            char layer = S_now.id.second;
+    size_t class_now = static_cast<size_t>(class_label);
+    uint8_t max_index = std::distance(Neu_acc.begin(), std::max_element(Neu_acc.begin(), Neu_acc.end()));
+    bool is_correct = (max_index == class_now);
+    return is_correct;
+}
 
-            if (layer == 'r') {
-                for (size_t j = 0; j < Neu_res.size(); ++j) {
-                    Neu_res[j].in(W_res[id_now][j]);
-                }
-                for (size_t j = 0; j < Neu_out.size(); ++j) {
-                    Neu_out[j].in(W_out[id_now][j]);
-                }
-            } else if (layer == 'i') {
-                for (size_t j = 0; j < Neu_res.size(); ++j) {
-                    Neu_res[j].in(W_in[id_now][j]);
+// Serial start of a step: keep the reservoir spikes of the previous step for feedback learning,
+// advance the clock, drain the spikes and feedback learning due now, pick the reservoir neurons to
+// step and gather the weight rows to propagate. Returns false past T_sim.
+template <typename State, typename Weight>
+template <typename Policy>
+bool Core<State, Weight>::begin_step(Step& step) {
+    if constexpr (Policy::feedback) {
+        // the reservoir spikes of the previous step are kept if some of its SG firings learn with them
+        if (enabling_train && !S_vec_now.empty()) {
+            uint32_t T_learn = step.T_now + t_delay;
+            if (fb_post_queue.pending_at(T_learn)) {
+                for (const auto& S_now : S_vec_now) {
+                    if (S_now.layer() == 'r') fb_pre_queue.push(0, T_learn, static_cast<uint32_t>(S_now.index()));
                 }
             }
         }
-#if defined(TRAIN_FA) || defined(TRAIN_DFA)
-        while (!Event_queue_delay.empty() && Event_queue_delay.top().time <= T_now) {
-            #pragma omp critical
-            {
-                Event_vec_now.push_back(Event_queue_delay.top());
-                Event_queue_delay.pop();
-            }
-        }
-#endif
-#if defined(TRAIN_ELIGIBLETRACE)
-        while (!S_vec_trace.empty() && S_vec_trace.top().time <= T_now) {
-            #pragma omp critical
-            {
-            S_vec_trace_now.push_back(S_vec_trace.top());
-            S_vec_trace.pop();
-            }
+    }
+    S_vec_now.clear();
+    S_vec_trace_now.clear();
+    fb_pre_now.clear();
+    fb_post_now.clear();
+
+    uint32_t T_external = external_S_train.empty() ? T_sim + 1 : external_S_train.next_time();
+    uint32_t T_internal = internal_S_queue.empty() ? T_sim + 1 : internal_S_queue.next_time();
+    uint32_t T_now = std::min(T_external, T_internal);
+    if (T_now > T_sim) return false;
+
+    // early decision, only in inference
+    if (early_stop_margin > 0 && !enabling_train && output_margin(Neu_acc.begin(), Neu_acc.end()) >= early_stop_margin) return false;
+    step.T_now = T_now;
+    decision_time = T_now;
+
+    // Input frame of this time step, [first, second) in external_S_train
+    std::pair<size_t, size_t> in_frame = external_S_train.advance(T_now);
+    internal_S_queue.drain(T_now, S_vec_now);
+
+    train_index = static_cast<size_t>(static_cast<size_t>(T_now) % N_out_times);
+    step.train_signal = 0;
+    if constexpr (Policy::phase) {
+        step.train_signal = static_cast<size_t>(((static_cast<size_t>(T_now) + PTE_range * PTE_slide) / PTE_range) % PTE_times);
+    }
+
+    // Reservoir neurons stepped at this time, the output layer is small and always fully stepped
+    step.res_now = active_set ? &collect_res_active(in_frame) : &Neu_res_all;
+
+    // a fully stepped population shares T_last, so the decay is one factor per tau class
+    if (!active_set) Neu_res.set_class_decay(T_now);
+    Neu_out.set_class_decay(T_now);
+
+    // Input spikes are read straight from the sorted train, indices from N_in on are 'b' side and not propagated
+    rows_res.clear();
+    rows_out.clear();
+    for (size_t i = in_frame.first; i < in_frame.second; ++i) {
+        uint16_t id_now = external_S_train.ids[i];
+        if (id_now < N_in) rows_res.push_back(W_in[id_now].data());
+    }
+    for (const auto& S_now : S_vec_now) {
+        if (S_now.layer() != 'r') continue;
+        if (!W_res_sparse) rows_res.push_back(W_res[S_now.index()].data());
+        rows_out.push_back(W_out[S_now.index()].data());
+    }
+
+    if constexpr (Policy::feedback) {
+        fb_pre_queue.drain(T_now, fb_pre_now);
+        fb_post_queue.drain(T_now, fb_post_now);
+    }
+    if constexpr (Policy::trace) {
+        collect_trace(T_now);
+    }
+
+    step.work = (rows_res.size() + rows_out.size() + 1) * step.res_now->size();
+    return true;
+}
+
+// Body of a step on thread tid of n_threads, called by every thread of the team (or by one with
+// n_threads = 1). Thread 0 also steps the output layer; the reservoir is split in blocks on
+// multiples of 8 neurons so neighbouring blocks do not share cache lines. Spikes go to lane tid of
+// the delay wheels, so after the lane-order drain they are in ascending neuron order whatever the
+// thread count. Weights are only updated once every thread is past propagation.
+template <typename State, typename Weight>
+template <typename Policy>
+void Core<State, Weight>::run_step(const Step& step, size_t tid, size_t n_threads, Weight w_step, Weight w_clip) {
+    bool team = n_threads > 1;
+    bool training = enabling_train && !step.train_signal;
+
+    if (tid == 0) step_output<Policy>(step);
+
+    size_t n_blocks = (Neu_res.size() + 7) / 8;
+    size_t lo = std::min(Neu_res.size(), n_blocks * tid / n_threads * 8);
+    size_t hi = std::min(Neu_res.size(), n_blocks * (tid + 1) / n_threads * 8);
+    step_reservoir<Policy>(step, lo, hi, tid);
+
+    if (training) {
+        if (team) {
+            #pragma omp barrier
         }
-#endif
-        // std::cout << "after spike sampling " << std::endl;
+        // the row blocks of the reservoir, step counts are added by one thread
+        if (!defer_updates) learn<Policy>(lo, hi, w_step, w_clip);
+        else if (tid == 0) learn<Policy>(0, Neu_res.size(), w_step, w_clip);
+    }
+    if (team) {
+        #pragma omp barrier
+    }
+}
+
+// Output layer of a step: leak, input, firing and the learning signs of the output neurons.
+// The updates of a step form outer products: every reservoir spike of the step (and of the trace)
+// with the sign of each output neuron, and every feedback synapse (reservoir spike to SG firing of
+// t_delay earlier) with the W_fb signs of the fed back output neurons. Only the signs are set here, learn applies them.
+template <typename State, typename Weight>
+template <typename Policy>
+void Core<State, Weight>::step_output(const Step& step) {
+    uint32_t T_now = step.T_now;
+    size_t train_signal = step.train_signal;
+    size_t class_now = static_cast<size_t>(class_label);
 
-        // checking firing
-        #pragma omp parallel sections
-        {
-            #pragma omp section
+    if (enabling_train && !train_signal) {
+        std::fill(out_sign.begin(), out_sign.end(), 0);
+        std::fill(out_sign_trace.begin(), out_sign_trace.end(), 0);
+        fb_sign.clear();
+    }
+
+    for (size_t i = 0; i < Neu_out.size(); ++i) {
+        Neu_out.leak_uniform(i, T_now);
+    }
+    accumulate_rows(I_out.data(), rows_out.data(), rows_out.size(), 0, Neu_out.size());
+    Neu_out.template in<Policy::refractory>(0, Neu_out.size(), I_out.data(), T_now);
+    for (size_t i = 0; i < Neu_out.size(); ++i) {
+        if (Neu_out.is_firing(i)) {
+            bool SG_now = Neu_out.template get_SG<Policy::refractory>(i, T_now);
+            if (enabling_train && !train_signal)
             {
-                #pragma omp parallel for
-                for (size_t i = 0; i < Neu_res.size(); ++i) {
-                    if (Neu_res[i].is_firing()) {
-                        if (enabling_train) {
-#if defined(TRAIN_FA) || defined(TRAIN_DFA)
-                            bool SG_now = Neu_res[i].get_SG();
-                            if (SG_now) {
-                                for (const auto& S_now : S_vec_now) {
-                                    int id_now = S_now.id.first;
-                                    char layer = S_now.id.second;
-                                    if (layer == 'r') {
-                                        std::pair<int, char> spk_id = std::make_pair(id_now, 'r');
-                                        std::pair<int, char> neu_id = std::make_pair(i, 'r');
-                                        Event_unit event(T_now + t_delay, spk_id, neu_id, true);
-                                        #pragma omp critical
-                                        {
-                                            Event_queue_delay.push(event);
-                                        }
-                                    }
-                                    /*
-                                    else if (layer == 'i') {
-                                        std::pair<int, char> spk_id = std::make_pair(id_now, 'i');
-                                        std::pair<int, char> neu_id = std::make_pair(i, 'r');
-                                        Event_unit event(T_now + t_delay, spk_id, neu_id, true);
-                                        #pragma omp critical
-                                        {
-                                            Event_queue_delay.push(event);
-                                        }
-                                    }
-                                    */
-                                }
-                            }
-#endif
-#if defined(TRAIN_ELIGIBLETRACE)
-                            #pragma omp critical
-                            {
-
-                                for (int n = 0; n < ET_N; ++n) {
-                                    S_vec_trace.push(Spike(T_now + t_delay + n + 1, {i, 'r'}));
-                                }
-                            }
-#endif
+                if ( (static_cast<size_t>(i / N_out_times) != class_now) && (static_cast<size_t>(i % N_out_times) == train_index) ) {
+                    if (SG_now) {
+                        out_sign[i] = -1;
+                        if constexpr (Policy::trace) {
+                            out_sign_trace[i] = -1;
                         }
-                        #pragma omp critical
-                        {
-                            internal_S_queue.push(Spike(T_now + t_delay, {i, 'r'}));
+                        if constexpr (Policy::fa) {
+                            fb_sign.emplace_back(i, -1);
                         }
-                        Neu_res[i].reset();
+                    }
+                    if constexpr (Policy::dfa) {
+                        fb_sign.emplace_back(i, -1);
                     }
                 }
             }
+            Neu_out.template reset<Policy::refractory>(i, T_now);
+            Neu_acc[static_cast<size_t>(i / N_out_times)] += 1;
+        }
+        // not firing but give the chance to negative update
+        // there is missing case on on-train-phase
+        // if SG is on, then the SG_ref would be flagged
+        // only ref 4 case ! and training_singal is 4 !
+        else if (Policy::phase && enabling_train && !train_signal && Neu_out.is_ref(i, T_now) && Neu_out.is_SG_ref(i, T_now) && (static_cast<size_t>(i / N_out_times) != class_now) && (static_cast<size_t>(i % N_out_times) == train_index) ){
+            out_sign[i] = -1;
+        }
+    }
 
-            #pragma omp section
-            {
-                #pragma omp parallel for
-                for (size_t i = 0; i < Neu_out.size(); ++i) {
-                    if (Neu_out[i].is_firing()) {
-                        bool SG_now = Neu_out[i].get_SG();
-#if defined(TRAIN_PHASE)
-                        if (enabling_train && !train_signal)
-#else
-                        if (enabling_train)
-#endif
-                        {
-                            if ( (static_cast<size_t>(i / N_out_times) != class_now) && (static_cast<size_t>(i % N_out_times) == train_index) ) {
-                                if (SG_now) {
-                                    for (const auto& S_now : S_vec_now) {
-                                        int id_now = S_now.id.first;
-                                        char layer = S_now.id.second;
-
-                                        if (layer == 'r') {
-                                            std::pair<int, char> spk_id = std::make_pair(id_now, 'r');
-                                            std::pair<int, char> neu_id = std::make_pair(i, 'o');
-                                            Event_unit event(T_now, spk_id, neu_id, false);
-                                            #pragma omp critical
-                                            {
-                                                Event_queue.push(event);
-                                            }
-                                        }
-                                    }
-    #if defined(TRAIN_ELIGIBLETRACE)
-                                    for (const auto& S_now : S_vec_trace_now) {
-                                        int id_now = S_now.id.first;
-                                        char layer = S_now.id.second;
-
-                                        if (layer == 'r') {
-                                            std::pair<int, char> spk_id = std::make_pair(id_now, 'r');
-                                            std::pair<int, char> neu_id = std::make_pair(i, 'o');
-                                            Event_unit event(T_now, spk_id, neu_id, false);
-                                            #pragma omp critical
-                                            {
-                                                Event_queue.push(event);
-                                            }
-                                        }
-                                    }
-    #endif
-    #if defined(TRAIN_FA)
-                                    for (const auto& E_now : Event_vec_now) {
-                                    int spk_id_now = E_now.spk_id.first;
-                                    int neu_id_now = E_now.neu_id.first;
-                                    Event_unit event(T_now, E_now.spk_id, E_now.neu_id, false == W_fb[neu_id_now][i]);
-                                    #pragma omp critical
-                                    {
-                                        Event_queue.push(event);
-                                    }
-                                }
-    #endif
-                                }
-    #if defined(TRAIN_DFA)
-                                for (const auto& E_now : Event_vec_now) {
-                                    int spk_id_now = E_now.spk_id.first;
-                                    int neu_id_now = E_now.neu_id.first;
-                                    Event_unit event(T_now, E_now.spk_id, E_now.neu_id, false == W_fb[neu_id_now][i]);
-                                    #pragma omp critical
-                                    {
-                                        Event_queue.push(event);
-                                    }
-                                }
-    #endif
-                            }
-                        }
-                        Neu_out[i].reset();
-                        #pragma omp atomic
-                        Neu_acc[static_cast<size_t>(i / N_out_times)] += 1;
+    if (enabling_train && !train_signal) {
+        for (size_t k = 0; k < N_out_times; ++k) {
+            size_t i = class_now * N_out_times + k;
+            if (k == train_index && (!Policy::refractory || (!Neu_out.is_firing(i) && !Neu_out.is_ref(i, T_now) && !Neu_out.is_SG_ref(i, T_now)))) {
+                bool SG_now = Neu_out.template get_SG<Policy::refractory>(i, T_now);
+                if (SG_now) {
+                    out_sign[i] = 1;
+                    if constexpr (Policy::trace) {
+                        out_sign_trace[i] = 1;
                     }
-#if defined(TRAIN_PHASE)
-                // not firing but give the chance to negative update
-                // there is missing case on on-train-phase
-                // if SG is on, then the SG_ref would be flagged
-                // only ref 4 case ! and training_singal is 4 !
-                else if (enabling_train && !train_signal && Neu_out[i].is_ref(T_now) && Neu_out[i].is_SG_ref(T_now) && (static_cast<size_t>(i / N_out_times) != class_now) && (static_cast<size_t>(i % N_out_times) == train_index) ){
-                    for (const auto& S_now : S_vec_now) {
-                        int id_now = S_now.id.first;
-                        char layer = S_now.id.second;
-
-                        if (layer == 'r') {
-                            std::pair<int, char> spk_id = std::make_pair(id_now, 'r');
-                            std::pair<int, char> neu_id = std::make_pair(i, 'o');
-                            Event_unit event(T_now, spk_id, neu_id, false);
-                            #pragma omp critical
-                            {
-                                Event_queue.push(event);
-                            }
-                        }
+                    if constexpr (Policy::fa) {
+                        /*FA*/
+                        fb_sign.emplace_back(i, 1);
                     }
                 }
-#endif
-            }
+                if constexpr (Policy::dfa) {
+                    /*DFA*/
+                    fb_sign.emplace_back(i, 1);
+                }
             }
+        }
+    }
+}
 
-            #pragma omp section
-#if defined(TRAIN_PHASE)
-            if (enabling_train && !train_signal) {
-#else
-            if (enabling_train) {
-#endif
-                #pragma omp parallel for
-                for (int k = 0; k < N_out_times; ++k) {
-        #if defined(REFRACTORY)
-                    if (!Neu_out[class_now * N_out_times + k].is_firing() && !Neu_out[class_now * N_out_times + k].is_ref(T_now) && k == train_index && !Neu_out[class_now * N_out_times + k].is_SG_ref(T_now)) {
-        #endif
-                        bool SG_now = Neu_out[class_now * N_out_times + k].get_SG();
-                        if (SG_now) {
-                            for (const auto& S_now : S_vec_now) {
-                                int id_now = S_now.id.first;
-                                char layer = S_now.id.second;
-
-                                if (layer == 'r') {
-                                    std::pair<int, char> spk_id = std::make_pair(id_now, 'r');
-                                    std::pair<int, char> neu_id = std::make_pair(class_now * N_out_times + k, 'o');
-                                    Event_unit event(T_now, spk_id, neu_id, true);
-                                    #pragma omp critical
-                                    {
-                                        Event_queue.push(event);
-                                    }
-                                }
-                            }
-#if defined(TRAIN_ELIGIBLETRACE)
-                            for (const auto& S_now : S_vec_trace_now) {
-                                int id_now = S_now.id.first;
-                                char layer = S_now.id.second;
-
-                                if (layer == 'r') {
-                                    std::pair<int, char> spk_id = std::make_pair(id_now, 'r');
-                                    std::pair<int, char> neu_id = std::make_pair(class_now * N_out_times + k, 'o');
-                                    Event_unit event(T_now, spk_id, neu_id, true);
-                                    #pragma omp critical
-                                    {
-                                        Event_queue.push(event);
-                                    }
-                                }
-                            }
-#endif
-#if defined(TRAIN_FA)
-                            /*FA*/
-                            for (const auto& E_now : Event_vec_now) {
-                            int spk_id_now = E_now.spk_id.first;
-                            int neu_id_now = E_now.neu_id.first;
-                            Event_unit event(T_now, E_now.spk_id, E_now.neu_id, true == W_fb[neu_id_now][class_now*N_out_times + k]);
-                            #pragma omp critical
-                            {
-                                Event_queue.push(event);
-                            }
-                        }
-#endif
-                        }
-#if defined(TRAIN_DFA)
-                        /*DFA*/
-                        for (const auto& E_now : Event_vec_now) {
-                            int spk_id_now = E_now.spk_id.first;
-                            int neu_id_now = E_now.neu_id.first;
-                            Event_unit event(T_now, E_now.spk_id, E_now.neu_id, true == W_fb[neu_id_now][class_now*N_out_times + k]);
-                            #pragma omp critical
-                            {
-                                Event_queue.push(event);
-                            }
-                        }
-#endif
-                    }
+// Learning of a step on the weight rows of the presynaptic reservoir neurons [lo, hi): one clamped
+// +-step per synapse and spike (update_row on W_out), or the step counts with deferred updates.
+// Rows are not shared between the blocks of the team, so no atomics are needed.
+template <typename State, typename Weight>
+template <typename Policy>
+void Core<State, Weight>::learn(size_t lo, size_t hi, Weight w_step, Weight w_clip) {
+    auto learn_out = [&](const std::vector<Spike>& spikes, const std::vector<int8_t>& sign) {
+        if (std::all_of(sign.begin(), sign.end(), [](int8_t s) { return s == 0; })) return;
+        for (const auto& S_now : spikes) {
+            size_t pre = S_now.index();
+            if (S_now.layer() != 'r' || pre < lo || pre >= hi) continue;
+            if (defer_updates) {
+                for (size_t i = 0; i < sign.size(); ++i) {
+                    if (sign[i] != 0) dW_out.add(static_cast<uint64_t>(pre) * Neu_out.size() + i, sign[i]);
                 }
+            } else {
+                update_row(W_out[pre].data(), sign.data(), sign.size(), w_step, w_clip);
             }
         }
+    };
+    learn_out(S_vec_now, out_sign);
+    if constexpr (Policy::trace) {
+        learn_out(S_vec_trace_now, out_sign_trace);
+    }
 
-        if (enabling_train && !train_signal) {
-
-            // std::cout << "Here is training part"<< std::endl;
-            std::vector<Event_unit> events;
-            #pragma omp critical
-            {
-                while (!Event_queue.empty()) {
-                    events.push_back(Event_queue.top());
-                    Event_queue.pop();
+    if constexpr (Policy::feedback) {
+        if (fb_sign.empty() || fb_post_now.empty()) return;
+        // spikes arrive in ascending neuron order, so the presynaptic rows [lo, hi) are one range
+        auto pre_begin = std::lower_bound(fb_pre_now.begin(), fb_pre_now.end(), lo);
+        auto pre_end = std::lower_bound(pre_begin, fb_pre_now.end(), hi);
+        if (pre_begin == pre_end) return;
+        for (uint32_t post : fb_post_now) {
+            // net steps of the synapses into post over the fed back output neurons
+            int32_t n = 0;
+            for (const auto& fb : fb_sign) n += W_fb[post][fb.first] ? fb.second : -fb.second;
+            if (n == 0) continue;
+            for (auto it = pre_begin; it != pre_end; ++it) {
+                size_t pre = *it;
+                // a sparse reservoir only learns on existing synapses
+                Weight* w = W_res_sparse ? W_res_csr.find(pre, post) : &W_res[pre][post];
+                if (w == nullptr) continue;
+                if (defer_updates) {
+                    dW_res.add(W_res_sparse ? static_cast<uint64_t>(w - W_res_csr.val.data()) : static_cast<uint64_t>(pre) * Neu_res.size() + post, n);
+                } else {
+                    apply_steps(*w, n, w_step, w_clip);
                 }
             }
+        }
+    }
+}
 
-            // std::cout << "events.size(): "<< events.size() << std::endl;
-
-            #pragma omp parallel for
-            for (std::size_t i = 0; i < events.size(); ++i) {
-                Event_unit& E_now = events[i];
-                int spk_id_now = E_now.spk_id.first;
-                char spk_l_now = E_now.spk_id.second;
-                int neu_id_now = E_now.neu_id.first;
-                char neu_l_now = E_now.neu_id.second;
-                bool sign = E_now.sign;
-                // std::cout << "Before update: W_out[" << spk_id_now << "][" << neu_id_now << "] = " << W_out[spk_id_now][neu_id_now] << std::endl;
-                if (spk_l_now == 'r' && neu_l_now == 'o') {
-                    if (sign) {
-                        #pragma omp atomic
-                        W_out[spk_id_now][neu_id_now] += lr*0.1;
-                        if (W_out[spk_id_now][neu_id_now] > 1.0*0.1) W_out[spk_id_now][neu_id_now] = 1.0*0.1;
-                    } else {
-                        #pragma omp atomic
-                        W_out[spk_id_now][neu_id_now] -= lr*0.1;
-                        if (W_out[spk_id_now][neu_id_now] < -1.0*0.1) W_out[spk_id_now][neu_id_now] = -1.0*0.1;
-                    }
-                }
-                // std::cout << "After update: W_out[" << spk_id_now << "][" << neu_id_now << "] = " << W_out[spk_id_now][neu_id_now] << std::endl;
-#if defined(TRAIN_FA) || defined(TRAIN_DFA)
-
-                else if (spk_l_now == 'r' && neu_l_now == 'r'){
-                    if (sign) {
-                        #pragma omp atomic
-                        W_res[spk_id_now][neu_id_now] += lr*0.1;
-                        if (W_res[spk_id_now][neu_id_now] > 0.10) W_res[spk_id_now][neu_id_now] = 0.1;
-                    } else {
-                        #pragma omp atomic
-                        W_res[spk_id_now][neu_id_now] -= lr*0.1;
-                        if (W_res[spk_id_now][neu_id_now] < -0.10) W_res[spk_id_now][neu_id_now] = -0.1;
-                    }
-                }
-                /*
-                else if (spk_l_now == 'i' && neu_l_now == 'r'){
-                    if (sign) {
-                        #pragma omp atomic
-                        W_in[spk_id_now][neu_id_now] += lr*0.1;
-                        if (W_in[spk_id_now][neu_id_now] > 0.1) W_in[spk_id_now][neu_id_now] = 0.1;
-                    } else {
-                        #pragma omp atomic
-                        W_in[spk_id_now][neu_id_now] -= lr*0.1;
-                        if (W_in[spk_id_now][neu_id_now] < -0.1) W_in[spk_id_now][neu_id_now] = -0.1;
-                    }
-                }
+// Reservoir neurons [lo, hi) of a step: leak, synaptic input and firing.
+// Each block sums the weight rows of every spike of the step into I_res (input frame, then
+// S_vec_now, with the vectorized row kernel) and applies the sum to each neuron once, so no neuron
+// is written by two threads.
+template <typename State, typename Weight>
+template <typename Policy>
+void Core<State, Weight>::step_reservoir(const Step& step, size_t lo, size_t hi, size_t lane) {
+    uint32_t T_now = step.T_now;
+    const std::vector<size_t>& res_now = *step.res_now;
+
+    // every neuron that got input is in res_now (sorted), I_res is left zeroed for the next step
+    auto a = std::lower_bound(res_now.begin(), res_now.end(), lo);
+    auto b = std::lower_bound(a, res_now.end(), hi);
+    bool full = b - a == static_cast<std::ptrdiff_t>(hi - lo);
+
+    if (active_set) {
+        for (auto it = a; it != b; ++it) Neu_res.leak(*it, T_now);
+    } else {
+        for (size_t i = lo; i < hi; ++i) Neu_res.leak_uniform(i, T_now);
+    }
 
-                else if (spk_l_now == 'r' && neu_l_now == 'r'){
-                    if (sign) {
-                        #pragma omp atomic
-                        W_res[spk_id_now][neu_id_now] += lr*0.1;
-                        if (W_res[spk_id_now][neu_id_now] > 1.0*0.1) W_res[spk_id_now][neu_id_now] = 1.0*0.1;
-                    } else {
-                        #pragma omp atomic
-                        W_res[spk_id_now][neu_id_now] -= lr*0.1;
-                        if (W_res[spk_id_now][neu_id_now] < -1.0*0.1) W_res[spk_id_now][neu_id_now] = -1.0*0.1;
-                    }
-                }*/
-#endif
+    accumulate_rows(I_res.data(), rows_res.data(), rows_res.size(), lo, hi);
+
+    if (W_res_sparse) {
+        for (const auto& S_now : S_vec_now) {
+            if (S_now.layer() != 'r') continue;
+            size_t id_now = S_now.index();
+
+            // columns are sorted, so this block is a contiguous part of the row
+            auto row_begin = W_res_csr.col_idx.begin() + W_res_csr.row_ptr[id_now];
+            auto row_end = W_res_csr.col_idx.begin() + W_res_csr.row_ptr[id_now + 1];
+            size_t k_lo = std::lower_bound(row_begin, row_end, lo) - W_res_csr.col_idx.begin();
+            size_t k_hi = std::lower_bound(row_begin, row_end, hi) - W_res_csr.col_idx.begin();
+            for (size_t k = k_lo; k < k_hi; ++k) {
+                I_res[W_res_csr.col_idx[k]] += W_res_csr.val[k];
             }
-            events.clear();
         }
+    }
 
-        /*
-        // L2 regularization
-        if (enabling_train && !train_signal) {
-            #pragma omp parallel for
-            for (size_t j = 0; j < Neu_res.size(); ++j) {
-                for (size_t i = 0; i < Neu_out.size(); ++i) {
-                    #pragma omp atomic
-                    W_out[i][j] -= lr * 0.1 * W_out[i][j];
-
-                    //if (W_out[i][j] > 0) W_out[i][j] -= lr
-                    //else W_out[i][j] += lr
+    if (full) {
+        Neu_res.template in<Policy::refractory>(lo, hi, I_res.data(), T_now);
+    } else {
+        for (auto it = a; it != b; ++it) {
+            Neu_res.template in<Policy::refractory>(*it, I_res[*it], T_now);
+            I_res[*it] = 0;
+        }
+    }
 
+    // checking firing
+    for (auto it = a; it != b; ++it) {
+        size_t i = *it;
+        if (!Neu_res.is_firing(i)) continue;
+        if (enabling_train) {
+            if constexpr (Policy::feedback) {
+                bool SG_now = Neu_res.template get_SG<Policy::refractory>(i, T_now);
+                if (SG_now) {
+                    // learns t_delay later with the reservoir spikes of this step, kept by the next begin_step
+                    fb_post_queue.push(lane, T_now + t_delay, static_cast<uint32_t>(i));
                 }
             }
-        }*/
+        }
+        internal_S_queue.push(lane, T_now + t_delay, Spike(T_now + t_delay, {i, 'r'}));
+        Neu_res.template reset<Policy::refractory>(i, T_now);
+    }
+}
 
-        S_vec_now.clear();
-        S_vec_trace_now.clear();
-        S_vec_trace_delay_now.clear();
-        Event_vec_now.clear();
+// Size the per-step buffers for the largest step they can see, so the run loop does not allocate.
+// A no-op once they are sized; copies of a core start unsized.
+template <typename State, typename Weight>
+template <typename Policy>
+void Core<State, Weight>::reserve_buffers() {
+    size_t N_res = Neu_res.size();
+    // a neuron fires at most once per tick, so a tick delivers at most N_res spikes
+    S_vec_now.reserve(N_res);
+    internal_S_queue.reserve(N_res);
+    rows_res.reserve(N_in + N_res);
+    rows_out.reserve(N_res);
+    fb_sign.reserve(Neu_out.size());
+    if constexpr (Policy::feedback) {
+        if (enabling_train) {
+            fb_pre_queue.reserve(N_res);
+            fb_post_queue.reserve(N_res);
+            fb_pre_now.reserve(N_res);
+            fb_post_now.reserve(N_res);
+        }
+    }
+    if constexpr (Policy::trace) {
+        if (enabling_train) {
+            // the last ET_N firing ticks stay live, the j-th newest replayed up to ET_N - j times
+            // after a quiet gap, and trace_fired holds ET_N + 1 ticks, twice for its compaction
+            S_vec_trace_now.reserve(ET_N * (ET_N + 1) / 2 * N_res);
+            trace_fired.reserve(2 * (ET_N + 1) * N_res);
+        }
+    }
+}
 
-        S_vec_now.shrink_to_fit();
-        S_vec_trace_now.shrink_to_fit();
-        S_vec_trace_delay_now.shrink_to_fit();
-        Event_vec_now.shrink_to_fit();
+// Eligibility trace of a step: a reservoir spike fired at F is replayed once per tick of
+// F + t_delay + 1 .. F + t_delay + ET_N, so S_vec_trace_now gets it once per such tick passed since
+// the previous step (T_trace, T_now]. Firings are known from the spikes arriving now (fired at
+// T_now - t_delay) and kept in firing order in trace_fired until their window is over.
+template <typename State, typename Weight>
+void Core<State, Weight>::collect_trace(uint32_t T_now) {
+    for (size_t k = trace_head; k < trace_fired.size(); ++k) {
+        const Spike& fired = trace_fired[k];
+        uint32_t first = std::max(fired.time + t_delay + 1, T_trace + 1);
+        uint32_t last = std::min<uint32_t>(fired.time + t_delay + ET_N, T_now);
+        // windows start in firing order
+        if (fired.time + t_delay + 1 > T_now) break;
+        for (uint32_t t = first; t <= last; ++t) S_vec_trace_now.push_back(fired);
     }
-#if defined(TRAIN_PHASE)
-    PTE_slide = static_cast<size_t>((PTE_slide + 1) % PTE_times);
-#endif
-    // train_index = (train_index + 1) % N_out_times;
+    while (trace_head < trace_fired.size() && trace_fired[trace_head].time + t_delay + ET_N <= T_now) ++trace_head;
+    if (trace_head * 2 >= trace_fired.size()) {
+        trace_fired.erase(trace_fired.begin(), trace_fired.begin() + trace_head);
+        trace_head = 0;
+    }
+    T_trace = T_now;
 
-    uint8_t max_index = std::distance(Neu_acc.begin(), std::max_element(Neu_acc.begin(), Neu_acc.end()));
-    bool is_correct = (max_index == class_now);
-    return is_correct;
+    if (!enabling_train) return;
+    for (const auto& S_now : S_vec_now) {
+        if (S_now.layer() == 'r') trace_fired.push_back(Spike(T_now - t_delay, {S_now.index(), 'r'}));
+    }
 }
 
-// Load spike train
-void Core::load_spike_train(const std::vector<uint32_t>& spike_times, const std::vector<uint16_t>& neuron_indices) {
-    while (!external_S_queue.empty()) external_S_queue.pop();
-    for (size_t i = 0; i < spike_times.size(); ++i) {
-        if (neuron_indices[i] < 144) external_S_queue.push(Spike(spike_times[i], {neuron_indices[i], 'i'}));
-        else external_S_queue.push(Spike(spike_times[i], {neuron_indices[i] - 144, 'b'}));
+// Collect the reservoir neurons reached by the spikes of this step.
+// Dense rows (W_in, W_res unless sparse) reach every neuron, CSR rows only their columns.
+template <typename State, typename Weight>
+const std::vector<size_t>& Core<State, Weight>::collect_res_active(std::pair<size_t, size_t> in_frame) {
+    for (size_t i = in_frame.first; i < in_frame.second; ++i) {
+        if (external_S_train.ids[i] < N_in) return Neu_res_all;
     }
+
+    Neu_res_active.clear();
+    for (const auto& S_now : S_vec_now) {
+        if (S_now.layer() != 'r') continue;
+        if (!W_res_sparse) return Neu_res_all;
+
+        size_t id_now = S_now.index();
+        for (uint32_t k = W_res_csr.row_ptr[id_now]; k < W_res_csr.row_ptr[id_now + 1]; ++k) {
+            uint32_t j = W_res_csr.col_idx[k];
+            if (!Neu_res_touched[j]) {
+                Neu_res_touched[j] = 1;
+                Neu_res_active.push_back(j);
+            }
+        }
+    }
+
+    // ascending order keeps the firing order of the full sweep
+    for (size_t j : Neu_res_active) Neu_res_touched[j] = 0;
+    std::sort(Neu_res_active.begin(), Neu_res_active.end());
+    return Neu_res_active;
+}
+
+// Load spike train
+template <typename State, typename Weight>
+void Core<State, Weight>::load_spike_train(const std::vector<uint32_t>& spike_times, const std::vector<uint16_t>& neuron_indices) {
+    external_S_train.load(spike_times, neuron_indices);
+}
+
+// A time-sorted view is read in place and must stay valid until the sample has run
+template <typename State, typename Weight>
+void Core<State, Weight>::load_spike_train(const Spike_train_view& train) {
+    external_S_train.load(train);
 }
 
 // Record spike
-void Core::record_spike(uint32_t time, int neuron_index) {
+template <typename State, typename Weight>
+void Core<State, Weight>::record_spike(uint32_t time, int neuron_index) {
     recorded_times.push_back(time);
     recorded_neuron_indices.push_back(static_cast<uint16_t>(neuron_index));
 }
 
 // Save weights to a file
-void Core::save_weights(const std::string& filename) const {
+template <typename State, typename Weight>
+void Core<State, Weight>::save_weights(const std::string& filename) const {
     std::ofstream file(filename);
     if (!file.is_open()) {
         throw std::runtime_error("Could not open file for saving weights");
     }
 
     json weights_json;
-    weights_json["W_in"] = W_in;
-    weights_json["W_res"] = W_res;
-    weights_json["W_out"] = W_out;
-    weights_json["W_bias"] = W_bias;
+    weights_json["W_in"] = to_real_matrix(W_in);
+    weights_json["W_res"] = to_real_matrix(W_res_sparse ? W_res_csr.to_dense() : W_res);
+    weights_json["W_out"] = to_real_matrix(W_out);
+    weights_json["W_bias"] = to_real_matrix(W_bias);
 
     file << weights_json.dump(4);
     file.close();
 }
 
 // Load weights from a file
-void Core::load_weights(const std::string& filename) {
+template <typename State, typename Weight>
+void Core<State, Weight>::load_weights(const std::string& filename) {
     std::ifstream file(filename);
     if (!file.is_open()) {
         throw std::runtime_error("Could not open file for loading weights");
@@ -749,9 +1001,20 @@ void Core::load_weights(const std::string& filename) {
     json weights_json;
     file >> weights_json;
 
-    W_in = weights_json["W_in"].get<std::vector<std::vector<double>>>();
-    W_res = weights_json["W_res"].get<std::vector<std::vector<double>>>();
-    W_out = weights_json["W_out"].get<std::vector<std::vector<double>>>();
+    W_in = from_real_matrix<Weight>(weights_json["W_in"].get<std::vector<std::vector<double>>>());
+    N_in = W_in.size();
+    W_res = from_real_matrix<Weight>(weights_json["W_res"].get<std::vector<std::vector<double>>>());
+    W_out = from_real_matrix<Weight>(weights_json["W_out"].get<std::vector<std::vector<double>>>());
+
+    if (W_res_sparse) {
+        W_res_csr.assign(W_res);
+        W_res.clear();
+        W_res.shrink_to_fit();
+    }
 
     file.close();
 }
+
+template class Core<double, double>;
+template class Core<float, float>;
+template class Core<int16_t, int8_t>;
@@ -4,18 +4,46 @@
 #define CORE_H
 
 #include <vector>
-#include <queue>
 #include <string>
 #include "Neuron.h"
 #include "Spike.h"
-#include "Event_unit.h"
 #include "Config.h"
+#include "Delay_wheel.h"
+#include "Sparse_matrix.h"
+#include "Scalar_traits.h"
+#include "Train_policy.h"
+#include "Update_accumulator.h"
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
+template <typename State, typename Weight>
+class Batch_core;
+
+// Lead of the class with the most output spikes over the next one
+template <typename It>
+inline size_t output_margin(It first, It last) {
+    size_t top = 0, second = 0;
+    for (; first != last; ++first) {
+        size_t n = *first;
+        if (n > top) {
+            second = top;
+            top = n;
+        } else if (n > second) {
+            second = n;
+        }
+    }
+    return top - second;
+}
+
+// Event-driven reservoir core.
+// State is the membrane potential type and Weight the synaptic weight type (see Scalar_traits);
+// Core.cpp instantiates <double, double>, <float, float> and the fixed point <int16_t, int8_t>.
+template <typename State, typename Weight>
 class Core {
 public:
+    using acc_t = typename Scalar_traits<State>::acc_t;
+
     Core(const std::string& param_file, const std::string& weights_file, const std::vector<int>& tau_values);
     Core(const Config& config);
     Core(const Config& config, const std::vector<int>& tau_values);
@@ -24,12 +52,23 @@ public:
 
     bool run();
     void load_spike_train(const std::vector<uint32_t>& spike_times, const std::vector<uint16_t>& neuron_indices);
+    void load_spike_train(const Spike_train_view& train);
     void save_recorded_spikes(const std::string& filename);
     void save_weights(const std::string& filename) const;
     void load_weights(const std::string& filename);
 
     void reset(); // 초기화 함수 추가
 
+    // Mini-batch training: with deferred updates the +-steps counted by the run loop are kept
+    // instead of applied after each step, the counts of a batch are summed and applied once
+    void set_deferred_updates(bool on);
+    void add_deferred_updates(Core& other);
+    void apply_deferred_updates();
+    void copy_weights(const Core& other);
+
+    // Learning step lr * 0.1 in the weight format, throws if a nonzero lr rounds to no step
+    Weight learning_step() const;
+
     bool enabling_train;
     uint32_t T_sim;
     uint8_t class_label;
@@ -40,29 +79,88 @@ public:
     size_t PTE_slide = 0;
     size_t PTE_range = 1;
     double lr;
+    bool train_phase;   // phasic training (PTE_*) enabled, see Train_policy
+    int num_threads;    // size of the run loop team, 0 for the OpenMP default
+    size_t early_stop_margin;   // see Config, 0: run every sample to the end
+    uint32_t decision_time = 0; // time of the last step of the last run
 
 private:
-    std::vector<std::vector<double>> W_in, W_res, W_out, W_bias;
+    friend class Batch_core<State, Weight>;    // reads the weights and neuron parameters
+
+    using Run_loop = bool (Core::*)();
+    Run_loop run_loop_fn;    // run_loop instantiation for the configured modes
+
+    bool thread_pinning;
+    bool refractory;            // the run loop uses Train_policy::refractory, kept for Batch_core
+    size_t parallel_min_work;   // steps with fewer synaptic updates run on one thread
+
+    // Current time step, shared by the threads of the team
+    struct Step {
+        uint32_t T_now;
+        size_t train_signal;
+        const std::vector<size_t>* res_now;  // reservoir neurons stepped
+        size_t work;                         // synaptic updates
+    };
+
+    std::vector<std::vector<Weight>> W_in, W_res, W_out, W_bias;
+    size_t N_in;                        // inputs with a W_in row, higher input indices are 'b' side and not propagated
     std::vector<std::vector<bool>> W_fb;
-    std::vector<Neuron> Neu_res, Neu_out, Neu_bias;
+    Sparse_matrix<Weight> W_res_csr;    // used instead of W_res when W_res_sparse
+    bool W_res_sparse;
+    Neuron_population<State> Neu_res, Neu_out, Neu_bias;
     std::vector<size_t> Neu_acc;
-    std::priority_queue<Spike> external_S_queue;
-    std::priority_queue<Spike> internal_S_queue;
-    std::priority_queue<Spike> S_vec_trace;
-    std::priority_queue<Spike> S_vec_trace_delay;
-    std::priority_queue<Event_unit> Event_queue;
+    Spike_input external_S_train;
+    Delay_wheel<Spike> internal_S_queue;
+    std::vector<Spike> trace_fired;     // reservoir firings in the eligibility window, from trace_head
+    size_t trace_head = 0;
+    uint32_t T_trace = 0;               // previous step seen by the trace
     std::vector<Spike> S_vec_now;
     std::vector<Spike> S_vec_trace_now;
-    std::vector<Spike> S_vec_trace_delay_now;
-    std::vector<Event_unit> Event_vec_now;
-    std::priority_queue<Event_unit> Event_queue_delay;
+    // Feedback learning: the reservoir spikes of a step and its firing SG reservoir neurons, both
+    // due t_delay later, when the synapses between them learn from that step's fb_sign
+    std::vector<uint32_t> fb_pre_now, fb_post_now;
+    Delay_wheel<uint32_t> fb_pre_queue, fb_post_queue;
     uint32_t t_delay;
     size_t N_out_times;
 
+    bool active_set;
+    std::vector<size_t> Neu_res_all;     // every reservoir neuron, stepped when active_set is off
+    std::vector<size_t> Neu_res_active;  // reservoir neurons reached by the spikes of the current step
+    std::vector<uint8_t> Neu_res_touched;
+
+    // Per-step synaptic input, summed before it is applied to the membranes
+    aligned_vector<acc_t> I_res, I_out;
+    std::vector<const Weight*> rows_res, rows_out;
+
+    // Learning signs of the current step set by the output layer (see step_output): per output
+    // neuron for the reservoir spikes of the step and of the trace, and the fed back output neurons
+    std::vector<int8_t> out_sign, out_sign_trace;
+    std::vector<std::pair<size_t, int>> fb_sign;
+    // Deferred step counts keyed by pre * N_out + post, and by pre * N_res + post or the CSR position of a sparse W_res
+    bool defer_updates = false;
+    Update_accumulator dW_out, dW_res;
+
     std::vector<uint32_t> recorded_times;
     std::vector<uint16_t> recorded_neuron_indices;
 
+    template <typename Policy>
     bool run_loop();
+    template <Train_rule Rule, bool... Flags>
+    static Run_loop select_run_loop(const bool* flags);
+    template <typename Policy>
+    void reserve_buffers();
+    void collect_trace(uint32_t T_now);
+    const std::vector<size_t>& collect_res_active(std::pair<size_t, size_t> in_frame);
+    template <typename Policy>
+    bool begin_step(Step& step);
+    template <typename Policy>
+    void run_step(const Step& step, size_t tid, size_t n_threads, Weight w_step, Weight w_clip);
+    template <typename Policy>
+    void step_output(const Step& step);
+    template <typename Policy>
+    void step_reservoir(const Step& step, size_t lo, size_t hi, size_t lane);
+    template <typename Policy>
+    void learn(size_t lo, size_t hi, Weight w_step, Weight w_clip);
     void record_spike(uint32_t time, int neuron_index);
 };
 
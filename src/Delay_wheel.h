@@ -0,0 +1,139 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#ifndef DELAY_WHEEL_H
+#define DELAY_WHEEL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Timing wheel for the delayed traffic of a core (spikes and learning events).
+// An item pushed at T_now is due at most `horizon` ticks later and everything due is drained
+// before the next push, so with horizon + 1 slots every pending timestamp owns a slot of its own
+// and the pending times lie within `horizon` consecutive ticks.
+// Each slot has one lane per thread: a parallel loop pushes into its own lane without locking,
+// and lanes are drained in lane order. The due time of a slot is kept once per slot, so empty,
+// next_time and drain look at the horizon + 1 slots and only open the lanes of due slots.
+// clear() only starts a new generation; a lane of an older one is empty and is emptied on its next
+// push, so clearing between samples costs nothing however much was pending.
+template <typename T>
+class Delay_wheel {
+public:
+    Delay_wheel() : Delay_wheel(0, 1) {}
+    Delay_wheel(uint32_t horizon, size_t n_lanes)
+        : slots(horizon + 1, std::vector<Lane>(n_lanes)), due(horizon + 1) {}
+
+    // Grow the number of lanes, pending items are kept
+    void reserve_lanes(size_t n_lanes) {
+        for (auto& slot : slots) {
+            if (slot.size() < n_lanes) slot.resize(n_lanes);
+        }
+    }
+
+    // Room for n items in every lane, kept by drain and clear
+    void reserve(size_t n) {
+        for (auto& slot : slots) {
+            for (auto& l : slot) l.items.reserve(n);
+        }
+    }
+
+    // Push an item due at `time`, T_now < time <= T_now + horizon.
+    // Lanes of one slot may be pushed concurrently, they all store the same due time.
+    inline void push(size_t lane, uint32_t time, const T& item) {
+        size_t s = time % slots.size();
+        Lane& l = slots[s][lane];
+        if (l.generation != generation) {
+            l.items.clear();
+            l.generation = generation;
+        }
+        l.items.push_back(item);
+        if (due[s].generation.load(std::memory_order_relaxed) != generation) {
+            due[s].time.store(time, std::memory_order_relaxed);
+            due[s].generation.store(generation, std::memory_order_relaxed);
+        }
+    }
+
+    bool empty() const {
+        for (const auto& d : due) {
+            if (pending(d)) return false;
+        }
+        return true;
+    }
+
+    // Whether items are pending for `time`
+    bool pending_at(uint32_t time) const {
+        const Due& d = due[time % due.size()];
+        return pending(d) && d.time.load(std::memory_order_relaxed) == time;
+    }
+
+    // Earliest pending time, only valid if !empty()
+    uint32_t next_time() const {
+        return due[first_slot()].time.load(std::memory_order_relaxed);
+    }
+
+    // Append every item due at or before T_now to `out`, earliest slot first
+    template <typename Out>
+    void drain(uint32_t T_now, Out& out) {
+        if (empty()) return;
+        // the pending times are consecutive modulo the wheel from the earliest one
+        size_t first = first_slot();
+        for (size_t k = 0; k < slots.size(); ++k) {
+            size_t s = (first + k) % slots.size();
+            if (!pending(due[s])) continue;
+            if (due[s].time.load(std::memory_order_relaxed) > T_now) break;
+
+            for (auto& l : slots[s]) {
+                if (l.generation != generation) continue;
+                out.insert(out.end(), l.items.begin(), l.items.end());
+                l.items.clear();
+            }
+            due[s].generation.store(idle, std::memory_order_relaxed);
+        }
+    }
+
+    void clear() { ++generation; }
+
+private:
+    static constexpr uint64_t idle = ~uint64_t(0);
+
+    struct Lane {
+        uint64_t generation = 0;
+        std::vector<T> items;
+    };
+
+    // Due time of a slot, pending while its generation is the current one
+    struct Due {
+        std::atomic<uint64_t> generation{idle};
+        std::atomic<uint32_t> time{0};
+
+        Due() = default;
+        Due(const Due& other)
+            : generation(other.generation.load(std::memory_order_relaxed)), time(other.time.load(std::memory_order_relaxed)) {}
+        Due& operator=(const Due& other) {
+            generation.store(other.generation.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            time.store(other.time.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return *this;
+        }
+    };
+
+    bool pending(const Due& d) const { return d.generation.load(std::memory_order_relaxed) == generation; }
+
+    // Slot of the earliest pending time, only valid if !empty()
+    size_t first_slot() const {
+        size_t first = 0;
+        bool found = false;
+        for (size_t s = 0; s < due.size(); ++s) {
+            if (!pending(due[s])) continue;
+            if (!found || due[s].time.load(std::memory_order_relaxed) < due[first].time.load(std::memory_order_relaxed)) first = s;
+            found = true;
+        }
+        return first;
+    }
+
+    std::vector<std::vector<Lane>> slots;
+    std::vector<Due> due;
+    uint64_t generation = 0;
+};
+
+#endif // DELAY_WHEEL_H
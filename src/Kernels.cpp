@@ -0,0 +1,363 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#include "Kernels.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86
+#endif
+
+namespace {
+
+template <typename Acc, typename W>
+using accumulate_fn = void (*)(Acc*, const W* const*, size_t, size_t, size_t);
+template <typename W>
+using update_fn = void (*)(W*, const int8_t*, size_t, W, W);
+using decode_fn = void (*)(const uint8_t*, size_t, uint32_t*, uint16_t*);
+
+// Scalar tail shared by all variants, rows r .. r + n are added with the 4-row association
+template <typename Acc, typename W>
+inline void accumulate_tail(Acc* dst, const W* const* rows, size_t n, size_t j) {
+    switch (n) {
+        case 4: dst[j] += (Acc(rows[0][j]) + Acc(rows[1][j])) + (Acc(rows[2][j]) + Acc(rows[3][j])); break;
+        case 3: dst[j] += (Acc(rows[0][j]) + Acc(rows[1][j])) + Acc(rows[2][j]); break;
+        case 2: dst[j] += Acc(rows[0][j]) + Acc(rows[1][j]); break;
+        case 1: dst[j] += Acc(rows[0][j]); break;
+        default: break;
+    }
+}
+
+template <typename Acc, typename W>
+void accumulate_rows_scalar(Acc* dst, const W* const* rows, size_t n_rows, size_t begin, size_t end) {
+    for (size_t r = 0; r < n_rows; r += 4) {
+        size_t n = n_rows - r < 4 ? n_rows - r : 4;
+        for (size_t j = begin; j < end; ++j) {
+            accumulate_tail(dst, rows + r, n, j);
+        }
+    }
+}
+
+// One clamped step of row[j] in the direction of sign[j], int8 weights are summed in int32
+template <typename W, typename Acc>
+inline W step_clamped(W w, int8_t sign, W step, W clip) {
+    if (sign > 0) return static_cast<W>(std::min<Acc>(static_cast<Acc>(w) + step, clip));
+    if (sign < 0) return static_cast<W>(std::max<Acc>(static_cast<Acc>(w) - step, -static_cast<Acc>(clip)));
+    return w;
+}
+
+template <typename W, typename Acc>
+void update_row_scalar(W* row, const int8_t* sign, size_t n, W step, W clip) {
+    for (size_t j = 0; j < n; ++j) row[j] = step_clamped<W, Acc>(row[j], sign[j], step, clip);
+}
+
+void decode_spike_records_scalar(const uint8_t* src, size_t n, uint32_t* times, uint16_t* ids) {
+    for (size_t j = 0; j < n; ++j, src += 6) {
+        times[j] = (uint32_t(src[0]) << 24) | (uint32_t(src[1]) << 16) | (uint32_t(src[2]) << 8) | uint32_t(src[3]);
+        ids[j] = static_cast<uint16_t>((src[4] << 8) | src[5]);
+    }
+}
+
+#if defined(KERNELS_X86)
+// Two 6-byte records per 16-byte load, byte-reversed into place by one shuffle each for the
+// times and the indices. The loads read 4 bytes past the pair, so the last pairs go scalar.
+__attribute__((target("avx2")))
+void decode_spike_records_avx2(const uint8_t* src, size_t n, uint32_t* times, uint16_t* ids) {
+    const __m128i time_order = _mm_setr_epi8(3, 2, 1, 0, 9, 8, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i id_order = _mm_setr_epi8(5, 4, 11, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    size_t j = 0;
+    for (; j + 3 <= n; j += 2) {
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 6 * j));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(times + j), _mm_shuffle_epi8(r, time_order));
+        int32_t id_pair = _mm_cvtsi128_si32(_mm_shuffle_epi8(r, id_order));
+        std::memcpy(ids + j, &id_pair, sizeof(id_pair));
+    }
+    decode_spike_records_scalar(src + 6 * j, n - j, times + j, ids + j);
+}
+
+// Both clamped steps are computed and blended by sign, min/max take the operands in the order
+// of std::min/std::max so the lanes match the scalar step
+__attribute__((target("avx2")))
+void update_row_avx2(double* row, const int8_t* sign, size_t n, double step, double clip) {
+    const __m256d vs = _mm256_set1_pd(step), hi = _mm256_set1_pd(clip), lo = _mm256_set1_pd(-clip);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        int32_t s4;
+        std::memcpy(&s4, sign + j, sizeof(s4));
+        __m256i s = _mm256_cvtepi8_epi64(_mm_cvtsi32_si128(s4));
+        __m256d w = _mm256_loadu_pd(row + j);
+        __m256d up = _mm256_min_pd(hi, _mm256_add_pd(w, vs));
+        __m256d dn = _mm256_max_pd(lo, _mm256_sub_pd(w, vs));
+        w = _mm256_blendv_pd(w, up, _mm256_castsi256_pd(_mm256_cmpgt_epi64(s, zero)));
+        w = _mm256_blendv_pd(w, dn, _mm256_castsi256_pd(_mm256_cmpgt_epi64(zero, s)));
+        _mm256_storeu_pd(row + j, w);
+    }
+    update_row_scalar<double, double>(row + j, sign + j, n - j, step, clip);
+}
+
+__attribute__((target("avx2")))
+void update_row_avx2(float* row, const int8_t* sign, size_t n, float step, float clip) {
+    const __m256 vs = _mm256_set1_ps(step), hi = _mm256_set1_ps(clip), lo = _mm256_set1_ps(-clip);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m256i s = _mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(sign + j)));
+        __m256 w = _mm256_loadu_ps(row + j);
+        __m256 up = _mm256_min_ps(hi, _mm256_add_ps(w, vs));
+        __m256 dn = _mm256_max_ps(lo, _mm256_sub_ps(w, vs));
+        w = _mm256_blendv_ps(w, up, _mm256_castsi256_ps(_mm256_cmpgt_epi32(s, zero)));
+        w = _mm256_blendv_ps(w, dn, _mm256_castsi256_ps(_mm256_cmpgt_epi32(zero, s)));
+        _mm256_storeu_ps(row + j, w);
+    }
+    update_row_scalar<float, float>(row + j, sign + j, n - j, step, clip);
+}
+
+// int8: a saturating add of +-step then the clamp, the same as the int32 sum clamped to clip <= 127
+__attribute__((target("avx2")))
+void update_row_avx2(int8_t* row, const int8_t* sign, size_t n, int8_t step, int8_t clip) {
+    const __m256i vs = _mm256_set1_epi8(step), hi = _mm256_set1_epi8(clip), lo = _mm256_set1_epi8(static_cast<int8_t>(-clip));
+    size_t j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sign + j));
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + j));
+        __m256i up = _mm256_min_epi8(hi, _mm256_adds_epi8(w, vs));
+        __m256i dn = _mm256_max_epi8(lo, _mm256_subs_epi8(w, vs));
+        w = _mm256_blendv_epi8(w, up, _mm256_cmpgt_epi8(s, _mm256_setzero_si256()));
+        w = _mm256_blendv_epi8(w, dn, _mm256_cmpgt_epi8(_mm256_setzero_si256(), s));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + j), w);
+    }
+    update_row_scalar<int8_t, int32_t>(row + j, sign + j, n - j, step, clip);
+}
+
+// masked min/max: the lanes outside the mask keep w, and the unmasked forms trip
+// -Wmaybe-uninitialized in some GCC headers
+__attribute__((target("avx512f")))
+void update_row_avx512(double* row, const int8_t* sign, size_t n, double step, double clip) {
+    const __m512d vs = _mm512_set1_pd(step), hi = _mm512_set1_pd(clip), lo = _mm512_set1_pd(-clip);
+    const __m512i zero = _mm512_setzero_si512();
+    size_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m512i s = _mm512_maskz_cvtepi8_epi64(0xFF, _mm_loadl_epi64(reinterpret_cast<const __m128i*>(sign + j)));
+        __m512d w = _mm512_loadu_pd(row + j);
+        w = _mm512_mask_min_pd(w, _mm512_cmpgt_epi64_mask(s, zero), hi, _mm512_add_pd(w, vs));
+        w = _mm512_mask_max_pd(w, _mm512_cmplt_epi64_mask(s, zero), lo, _mm512_sub_pd(w, vs));
+        _mm512_storeu_pd(row + j, w);
+    }
+    update_row_scalar<double, double>(row + j, sign + j, n - j, step, clip);
+}
+
+__attribute__((target("avx512f")))
+void update_row_avx512(float* row, const int8_t* sign, size_t n, float step, float clip) {
+    const __m512 vs = _mm512_set1_ps(step), hi = _mm512_set1_ps(clip), lo = _mm512_set1_ps(-clip);
+    const __m512i zero = _mm512_setzero_si512();
+    size_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __m512i s = _mm512_maskz_cvtepi8_epi32(0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i*>(sign + j)));
+        __m512 w = _mm512_loadu_ps(row + j);
+        w = _mm512_mask_min_ps(w, _mm512_cmpgt_epi32_mask(s, zero), hi, _mm512_add_ps(w, vs));
+        w = _mm512_mask_max_ps(w, _mm512_cmplt_epi32_mask(s, zero), lo, _mm512_sub_ps(w, vs));
+        _mm512_storeu_ps(row + j, w);
+    }
+    update_row_scalar<float, float>(row + j, sign + j, n - j, step, clip);
+}
+
+__attribute__((target("avx2")))
+void accumulate_rows_avx2(double* dst, const double* const* rows, size_t n_rows, size_t begin, size_t end) {
+    for (size_t r = 0; r < n_rows; r += 4) {
+        size_t n = n_rows - r < 4 ? n_rows - r : 4;
+        const double* const* R = rows + r;
+        size_t j = begin;
+        for (; j + 4 <= end; j += 4) {
+            __m256d s = _mm256_loadu_pd(R[0] + j);
+            if (n == 4) {
+                s = _mm256_add_pd(_mm256_add_pd(s, _mm256_loadu_pd(R[1] + j)),
+                                  _mm256_add_pd(_mm256_loadu_pd(R[2] + j), _mm256_loadu_pd(R[3] + j)));
+            } else {
+                if (n >= 2) s = _mm256_add_pd(s, _mm256_loadu_pd(R[1] + j));
+                if (n == 3) s = _mm256_add_pd(s, _mm256_loadu_pd(R[2] + j));
+            }
+            _mm256_storeu_pd(dst + j, _mm256_add_pd(_mm256_loadu_pd(dst + j), s));
+        }
+        for (; j < end; ++j) {
+            accumulate_tail(dst, R, n, j);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+void accumulate_rows_avx2(float* dst, const float* const* rows, size_t n_rows, size_t begin, size_t end) {
+    for (size_t r = 0; r < n_rows; r += 4) {
+        size_t n = n_rows - r < 4 ? n_rows - r : 4;
+        const float* const* R = rows + r;
+        size_t j = begin;
+        for (; j + 8 <= end; j += 8) {
+            __m256 s = _mm256_loadu_ps(R[0] + j);
+            if (n == 4) {
+                s = _mm256_add_ps(_mm256_add_ps(s, _mm256_loadu_ps(R[1] + j)),
+                                  _mm256_add_ps(_mm256_loadu_ps(R[2] + j), _mm256_loadu_ps(R[3] + j)));
+            } else {
+                if (n >= 2) s = _mm256_add_ps(s, _mm256_loadu_ps(R[1] + j));
+                if (n == 3) s = _mm256_add_ps(s, _mm256_loadu_ps(R[2] + j));
+            }
+            _mm256_storeu_ps(dst + j, _mm256_add_ps(_mm256_loadu_ps(dst + j), s));
+        }
+        for (; j < end; ++j) {
+            accumulate_tail(dst, R, n, j);
+        }
+    }
+}
+
+// int8 weights are widened to int32 lanes, integer sums do not depend on the association
+__attribute__((target("avx2")))
+void accumulate_rows_avx2(int32_t* dst, const int8_t* const* rows, size_t n_rows, size_t begin, size_t end) {
+    for (size_t r = 0; r < n_rows; r += 4) {
+        size_t n = n_rows - r < 4 ? n_rows - r : 4;
+        const int8_t* const* R = rows + r;
+        size_t j = begin;
+        for (; j + 8 <= end; j += 8) {
+            __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + j));
+            for (size_t k = 0; k < n; ++k) {
+                __m128i w = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(R[k] + j));
+                s = _mm256_add_epi32(s, _mm256_cvtepi8_epi32(w));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + j), s);
+        }
+        for (; j < end; ++j) {
+            accumulate_tail(dst, R, n, j);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+void accumulate_rows_avx512(double* dst, const double* const* rows, size_t n_rows, size_t begin, size_t end) {
+    for (size_t r = 0; r < n_rows; r += 4) {
+        size_t n = n_rows - r < 4 ? n_rows - r : 4;
+        const double* const* R = rows + r;
+        size_t j = begin;
+        for (; j + 8 <= end; j += 8) {
+            __m512d s = _mm512_loadu_pd(R[0] + j);
+            if (n == 4) {
+                s = _mm512_add_pd(_mm512_add_pd(s, _mm512_loadu_pd(R[1] + j)),
+                                  _mm512_add_pd(_mm512_loadu_pd(R[2] + j), _mm512_loadu_pd(R[3] + j)));
+            } else {
+                if (n >= 2) s = _mm512_add_pd(s, _mm512_loadu_pd(R[1] + j));
+                if (n == 3) s = _mm512_add_pd(s, _mm512_loadu_pd(R[2] + j));
+            }
+            _mm512_storeu_pd(dst + j, _mm512_add_pd(_mm512_loadu_pd(dst + j), s));
+        }
+        for (; j < end; ++j) {
+            accumulate_tail(dst, R, n, j);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+void accumulate_rows_avx512(float* dst, const float* const* rows, size_t n_rows, size_t begin, size_t end) {
+    for (size_t r = 0; r < n_rows; r += 4) {
+        size_t n = n_rows - r < 4 ? n_rows - r : 4;
+        const float* const* R = rows + r;
+        size_t j = begin;
+        for (; j + 16 <= end; j += 16) {
+            __m512 s = _mm512_loadu_ps(R[0] + j);
+            if (n == 4) {
+                s = _mm512_add_ps(_mm512_add_ps(s, _mm512_loadu_ps(R[1] + j)),
+                                  _mm512_add_ps(_mm512_loadu_ps(R[2] + j), _mm512_loadu_ps(R[3] + j)));
+            } else {
+                if (n >= 2) s = _mm512_add_ps(s, _mm512_loadu_ps(R[1] + j));
+                if (n == 3) s = _mm512_add_ps(s, _mm512_loadu_ps(R[2] + j));
+            }
+            _mm512_storeu_ps(dst + j, _mm512_add_ps(_mm512_loadu_ps(dst + j), s));
+        }
+        for (; j < end; ++j) {
+            accumulate_tail(dst, R, n, j);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+void accumulate_rows_avx512(int32_t* dst, const int8_t* const* rows, size_t n_rows, size_t begin, size_t end) {
+    for (size_t r = 0; r < n_rows; r += 4) {
+        size_t n = n_rows - r < 4 ? n_rows - r : 4;
+        const int8_t* const* R = rows + r;
+        size_t j = begin;
+        for (; j + 16 <= end; j += 16) {
+            __m512i s = _mm512_loadu_si512(dst + j);
+            for (size_t k = 0; k < n; ++k) {
+                __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(R[k] + j));
+                // maskz form: the unmasked one trips -Wmaybe-uninitialized in some GCC headers
+                s = _mm512_add_epi32(s, _mm512_maskz_cvtepi8_epi32(0xFFFF, w));
+            }
+            _mm512_storeu_si512(dst + j, s);
+        }
+        for (; j < end; ++j) {
+            accumulate_tail(dst, R, n, j);
+        }
+    }
+}
+#endif
+
+struct Dispatch {
+    accumulate_fn<double, double> accumulate_f64;
+    accumulate_fn<float, float> accumulate_f32;
+    accumulate_fn<int32_t, int8_t> accumulate_i8;
+    update_fn<double> update_f64;
+    update_fn<float> update_f32;
+    update_fn<int8_t> update_i8;
+    decode_fn decode;
+    const char* isa;
+};
+
+Dispatch select_kernels() {
+#if defined(KERNELS_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        // int8 rows use the AVX2 kernel, 512-bit byte operations need AVX512BW
+        return {accumulate_rows_avx512, accumulate_rows_avx512, accumulate_rows_avx512,
+                update_row_avx512, update_row_avx512, update_row_avx2, decode_spike_records_avx2, "avx512f"};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return {accumulate_rows_avx2, accumulate_rows_avx2, accumulate_rows_avx2,
+                update_row_avx2, update_row_avx2, update_row_avx2, decode_spike_records_avx2, "avx2"};
+    }
+#endif
+    return {accumulate_rows_scalar<double, double>, accumulate_rows_scalar<float, float>, accumulate_rows_scalar<int32_t, int8_t>,
+            update_row_scalar<double, double>, update_row_scalar<float, float>, update_row_scalar<int8_t, int32_t>, decode_spike_records_scalar, "scalar"};
+}
+
+const Dispatch dispatch = select_kernels();
+
+} // namespace
+
+void accumulate_rows(double* dst, const double* const* rows, size_t n_rows, size_t begin, size_t end) {
+    dispatch.accumulate_f64(dst, rows, n_rows, begin, end);
+}
+
+void accumulate_rows(float* dst, const float* const* rows, size_t n_rows, size_t begin, size_t end) {
+    dispatch.accumulate_f32(dst, rows, n_rows, begin, end);
+}
+
+void accumulate_rows(int32_t* dst, const int8_t* const* rows, size_t n_rows, size_t begin, size_t end) {
+    dispatch.accumulate_i8(dst, rows, n_rows, begin, end);
+}
+
+void update_row(double* row, const int8_t* sign, size_t n, double step, double clip) {
+    dispatch.update_f64(row, sign, n, step, clip);
+}
+
+void update_row(float* row, const int8_t* sign, size_t n, float step, float clip) {
+    dispatch.update_f32(row, sign, n, step, clip);
+}
+
+void update_row(int8_t* row, const int8_t* sign, size_t n, int8_t step, int8_t clip) {
+    dispatch.update_i8(row, sign, n, step, clip);
+}
+
+void decode_spike_records(const uint8_t* src, size_t n, uint32_t* times, uint16_t* ids) {
+    dispatch.decode(src, n, times, ids);
+}
+
+const char* kernel_isa() {
+    return dispatch.isa;
+}
@@ -0,0 +1,30 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// dst[begin, end) += sum of rows[r][begin, end) for r < n_rows.
+// Rows are added four at a time as (r0 + r1) + (r2 + r3); every instruction set uses the same
+// association, so the AVX-512, AVX2 and scalar variants give bit-identical results.
+// One overload per Core instantiation: double, float and fixed point (int8 weights, int32 sums).
+void accumulate_rows(double* dst, const double* const* rows, size_t n_rows, size_t begin, size_t end);
+void accumulate_rows(float* dst, const float* const* rows, size_t n_rows, size_t begin, size_t end);
+void accumulate_rows(int32_t* dst, const int8_t* const* rows, size_t n_rows, size_t begin, size_t end);
+
+// Rank-1 learning update of one weight row: row[j] takes one step in the direction of sign[j]
+// (-1, 0 or 1), clamped to +-clip in that direction. All variants match the scalar step bit for bit.
+void update_row(double* row, const int8_t* sign, size_t n, double step, double clip);
+void update_row(float* row, const int8_t* sign, size_t n, float step, float clip);
+void update_row(int8_t* row, const int8_t* sign, size_t n, int8_t step, int8_t clip);
+
+// Split n big-endian spike records of the .bin dataset (4-byte time, 2-byte neuron index) into
+// host-order times and ids
+void decode_spike_records(const uint8_t* src, size_t n, uint32_t* times, uint16_t* ids);
+
+// Instruction set picked at runtime for the kernels: "avx512f", "avx2" or "scalar"
+const char* kernel_isa();
+
+#endif // KERNELS_H
@@ -3,107 +3,179 @@
 #ifndef NEURON_H
 #define NEURON_H
 
+#include <algorithm>
+#include <array>
 #include <cmath>
-#include <ostream>
-#include <iostream>
-
-class Neuron {
-private:
-    double V_mem;      // Membrane potential
-    double tau;        // Time constant
-    double V_th;       // Threshold potential
-    double V_bot;      // limited under value - HW constraint
-    double V_reset;    // Reset potential
-    uint32_t T_now;      // Current simulation time
-    uint32_t T_last;     // Time of the last update for leaky computation
-    double SG_window;  // Window for computing surrogate gradient
-    uint32_t T_SG;       // Time for surrogate gradient calculation
-
-#if defined(REFRACTORY)
-    uint32_t T_ref;      // End of refractory period
-    uint32_t t_ref;      // Duration of refractory period
-#endif
-
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Aligned_allocator.h"
+#include "Scalar_traits.h"
+
+// Population of leaky integrate-and-fire neurons in structure-of-arrays layout.
+// The state touched every step lives in separate aligned arrays, the parameters are stored
+// once per population, and the time constant once per tau class.
+// Decay factors exp(-dt / tau) come from a per-class table: exact for dt < decay_lut_size,
+// larger dt is split as dt = q * decay_lut_size + r and q is applied by squaring.
+// State is the type of the membrane potential (see Scalar_traits), parameters are given in real units.
+// A fixed point population also keeps the bits of V_mem below one LSB (V_frac) across leaks.
+template <typename State>
+class Neuron_population {
 public:
-#if defined(REFRACTORY)
-    Neuron(double V_init, double tau, double V_th, double V_bot, double V_reset, uint32_t t_ref, double SG_window)
-        : V_mem(V_init), tau(tau), V_th(V_th), V_bot(V_bot), V_reset(V_reset), T_now(0), T_last(0), SG_window(SG_window), T_SG(0), T_ref(0), t_ref(t_ref) {}
-#else
-    Neuron(double V_init, double tau, double V_th, double V_bot, double V_reset, double SG_window)
-        : V_mem(V_init), tau(tau), V_th(V_th), V_bot(V_bot), V_reset(V_reset), T_now(0), T_last(0), SG_window(SG_window), T_SG(0) {}
-#endif
+    using traits = Scalar_traits<State>;
+    using acc_t = typename traits::acc_t;
+    using decay_t = typename traits::decay_t;
+
+    static constexpr uint32_t decay_lut_size = 256;
+
+    Neuron_population() : V_th(0), V_bot(0), V_reset(0), SG_window(0), t_ref(0) {}
+    Neuron_population(const std::vector<double>& tau, double V_init, double V_th, double V_bot, double V_reset, uint32_t t_ref, double SG_window)
+        : V_mem(tau.size(), traits::from_real(V_init)), V_frac(traits::is_fixed ? tau.size() : 0, 0), T_last(tau.size(), 0), T_ref(tau.size(), 0), T_SG(tau.size(), 0), tau_class(tau.size(), 0),
+          V_th(traits::from_real(V_th)), V_bot(traits::from_real(V_bot)), V_reset(traits::from_real(V_reset)), SG_window(traits::from_real(SG_window)), t_ref(t_ref) {
+        for (size_t i = 0; i < tau.size(); ++i) {
+            auto it = std::find(tau_values.begin(), tau_values.end(), tau[i]);
+            if (it == tau_values.end()) it = tau_values.insert(it, tau[i]);
+            tau_class[i] = static_cast<uint16_t>(it - tau_values.begin());
+        }
+
+        decay_lut.resize(tau_values.size() * decay_lut_size);
+        decay_pow2.resize(tau_values.size());
+        decay_class.assign(tau_values.size(), traits::decay_factor(1.0));
+        for (size_t c = 0; c < tau_values.size(); ++c) {
+            for (uint32_t dt = 0; dt < decay_lut_size; ++dt) {
+                decay_lut[c * decay_lut_size + dt] = std::exp(-(static_cast<double>(dt)) / tau_values[c]);
+            }
+            for (size_t k = 0; k < decay_pow2[c].size(); ++k) {
+                decay_pow2[c][k] = std::exp(-(static_cast<double>(uint64_t(decay_lut_size) << k)) / tau_values[c]);
+            }
+            // a sub-threshold potential has to decay at every tick, not be held by a factor rounded to 1
+            if (traits::decay_factor(decay_lut[c * decay_lut_size + 1]) >= traits::decay_factor(1.0) && decay_lut[c * decay_lut_size + 1] < 1.0) {
+                throw std::runtime_error("tau " + std::to_string(tau_values[c]) + " is too long for the leak of this precision");
+            }
+        }
+    }
+
+    size_t size() const { return V_mem.size(); }
 
     // Getter methods
-    double get_tau() const { return tau; }
-    double get_V_th() const { return V_th; }
-    double get_V_bot() const { return V_bot; }
-    double get_V_reset() const { return V_reset; }
-    double get_V_mem() const { return V_mem; }
-    double get_SG_window() const { return SG_window; }
-    uint32_t get_T_last() const { return T_last; }
-
-#if defined(REFRACTORY)
-    uint32_t get_t_ref() const { return t_ref; }
-#endif
+    double get_tau(size_t i) const { return tau_values[tau_class[i]]; }
+    State get_V_mem(size_t i) const { return V_mem[i]; }
+    uint32_t get_T_last(size_t i) const { return T_last[i]; }
+
+    // Decay factor of tau class c over dt ticks
+    inline double decay(uint16_t c, uint32_t dt) const {
+        double factor = decay_lut[c * decay_lut_size + dt % decay_lut_size];
+        uint32_t q = dt / decay_lut_size;
+        for (size_t k = 0; q != 0; ++k, q >>= 1) {
+            if (q & 1) factor *= decay_pow2[c][k];
+        }
+        return factor;
+    }
 
     // Leaky function to update the membrane potential with exponential decay
-    inline void leak(uint32_t current_time) {
-        T_now = current_time;
-        if (T_now == T_last) return;
-        V_mem *= std::exp(-(static_cast<double>(T_now - T_last)) / tau);
-        T_last = T_now;
+    inline void leak(size_t i, uint32_t T_now) {
+        if (T_now == T_last[i]) return;
+        decay_V_mem(i, traits::decay_factor(decay(tau_class[i], T_now - T_last[i])));
+        T_last[i] = T_now;
+    }
+
+    // Leak when every neuron shares T_last (fully stepped population): one factor per tau class,
+    // set_class_decay is called once per step before leak_uniform on the neurons
+    inline void set_class_decay(uint32_t T_now) {
+        if (T_last.empty()) return;
+        uint32_t dt = T_now - T_last[0];
+        for (size_t c = 0; c < decay_class.size(); ++c) decay_class[c] = traits::decay_factor(decay(static_cast<uint16_t>(c), dt));
+    }
+
+    inline void leak_uniform(size_t i, uint32_t T_now) {
+        decay_V_mem(i, decay_class[tau_class[i]]);
+        T_last[i] = T_now;
     }
 
-    // Function to apply an external input
-    inline void in(double input) {
-#if defined(REFRACTORY)
-        if (T_now < T_ref) {
-            return;
+    inline void decay_V_mem(size_t i, decay_t f) {
+        if constexpr (traits::is_fixed) {
+            V_mem[i] = traits::decay(V_mem[i], V_frac[i], f);
+        } else {
+            V_mem[i] = traits::decay(V_mem[i], f);
         }
-#endif
-        V_mem += input;
-        // clamped V_mem
-        if (V_mem < V_bot) V_mem = V_bot;
+    }
+
+    // Apply the summed input I[i] of a step to neurons [begin, end) and clear it,
+    // branch-free refractory mask and clamped V_mem
+    template <bool Refractory>
+    inline void in(size_t begin, size_t end, acc_t* I, uint32_t T_now) {
+        for (size_t i = begin; i < end; ++i) {
+            in<Refractory>(i, I[i], T_now);
+            I[i] = 0;
+        }
+    }
+
+    template <bool Refractory>
+    inline void in(size_t i, acc_t input, uint32_t T_now) {
+        if constexpr (Refractory) {
+            input = (T_now < T_ref[i]) ? acc_t(0) : input;
+        }
+        V_mem[i] = traits::saturate(std::max(static_cast<acc_t>(V_mem[i]) + input, static_cast<acc_t>(V_bot)));
     }
 
     // Function to check if the neuron is firing
-    inline bool is_firing() const { return V_mem >= V_th; }
+    inline bool is_firing(size_t i) const { return V_mem[i] >= V_th; }
 
     // Function to reset the membrane potential to the resting state after firing
-    inline void reset() {
-        V_mem = V_reset;
-#if defined(REFRACTORY)
-        T_ref = T_now + t_ref;
-#endif
+    template <bool Refractory>
+    inline void reset(size_t i, uint32_t T_now) {
+        V_mem[i] = V_reset;
+        if constexpr (traits::is_fixed) V_frac[i] = 0;
+        if constexpr (Refractory) {
+            T_ref[i] = T_now + t_ref;
+        }
     }
 
-    // Function to reset the membrane potential to the resting state after firing
-    inline void reset_ref() {
-#if defined(REFRACTORY)
-        T_SG = 0;
-        T_ref = 0;
-#endif
+    // Reset every neuron to the resting state before a new sample
+    inline void reset_all() {
+        std::fill(V_mem.begin(), V_mem.end(), V_reset);
+        std::fill(V_frac.begin(), V_frac.end(), 0);
+        std::fill(T_last.begin(), T_last.end(), 0);
+        std::fill(T_ref.begin(), T_ref.end(), 0);
+        std::fill(T_SG.begin(), T_SG.end(), 0);
     }
 
     // Function to compute surrogate gradient
-    inline bool get_SG() {
-        bool SG = std::abs(V_mem - V_th) < SG_window;
-#if defined(REFRACTORY)
-        // for negative/positive balanced update
-        // not t_ref? tau?
-        if (SG) T_SG = T_now + t_ref;
-#endif
+    template <bool Refractory>
+    inline bool get_SG(size_t i, uint32_t T_now) {
+        bool SG = std::abs(static_cast<acc_t>(V_mem[i]) - static_cast<acc_t>(V_th)) < static_cast<acc_t>(SG_window);
+        if constexpr (Refractory) {
+            // for negative/positive balanced update
+            // not t_ref? tau?
+            if (SG) T_SG[i] = T_now + t_ref;
+        }
         return SG;
     }
 
     // Function to check if surrogate gradient reference time is active
-    inline bool is_SG_ref(uint32_t T_now) const {
-
-        return T_now < T_SG; }
-
-#if defined(REFRACTORY)
-    inline bool is_ref(uint32_t T_now) const { return T_now < T_ref; }
-#endif
+    inline bool is_SG_ref(size_t i, uint32_t T_now) const { return T_now < T_SG[i]; }
+
+    inline bool is_ref(size_t i, uint32_t T_now) const { return T_now < T_ref[i]; }
+
+    // Hot state
+    aligned_vector<State> V_mem;        // Membrane potential
+    aligned_vector<uint16_t> V_frac;    // Bits of V_mem below one LSB, fixed point only
+    aligned_vector<uint32_t> T_last;    // Time of the last update for leaky computation
+    aligned_vector<uint32_t> T_ref;     // End of refractory period
+    aligned_vector<uint32_t> T_SG;      // Time for surrogate gradient calculation
+    aligned_vector<uint16_t> tau_class; // Index into tau_values
+
+    // Shared parameters
+    std::vector<double> tau_values;     // Time constant of each tau class
+    aligned_vector<double> decay_lut;   // exp(-dt / tau), [class][dt] for dt < decay_lut_size
+    std::vector<std::array<double, 32>> decay_pow2;  // exp(-(decay_lut_size << k) / tau) per class
+    std::vector<decay_t> decay_class;   // Per-class factor of the current step, see set_class_decay
+    State V_th;        // Threshold potential
+    State V_bot;       // limited under value - HW constraint
+    State V_reset;     // Reset potential
+    State SG_window;   // Window for computing surrogate gradient
+    uint32_t t_ref;    // Duration of refractory period
 };
 
 #endif // NEURON_H
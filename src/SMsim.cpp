@@ -9,12 +9,20 @@
 #include <sstream>
 #include <filesystem>
 #include <vector>
+#include <memory>
 #include <chrono>
 #include <nlohmann/json.hpp>
 #include <omp.h>
 #include <bitset>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 
 #include "Core.h"
+#include "Batch_core.h"
+#include "Spike_dataset.h"
+#include "Sample_prefetcher.h"
 
 #ifndef __GIT_REV__
 #define __GIT_REV__ "unknown"
@@ -36,156 +44,6 @@ uint16_t reverse_bytes(uint16_t value) {
            ((value & 0xFF00) >> 8);
 }
 
-// Calculate offsets for each entry in the binary file
-std::vector<std::streampos> calculate_offsets(const std::string& file_path, int& num_entries) {
-    std::ifstream file(file_path, std::ios::binary);
-    if (!file.is_open()) {
-        throw std::runtime_error("Could not open binary file");
-    }
-
-    std::vector<std::streampos> offsets;
-    uint8_t label;
-    uint16_t data_index;
-    uint32_t unique_global_id;
-    uint32_t num_data_points;
-    uint8_t reserved1;
-    uint8_t reserved2;
-
-    const int HEADER_SIZE = 13; // bytes
-
-    while (file.read(reinterpret_cast<char*>(&label), sizeof(uint8_t))) {
-        file.read(reinterpret_cast<char*>(&data_index), sizeof(uint16_t));
-        data_index = reverse_bytes(data_index);
-
-        file.read(reinterpret_cast<char*>(&unique_global_id), sizeof(uint32_t));
-        unique_global_id = reverse_bytes(unique_global_id);
-
-        file.read(reinterpret_cast<char*>(&num_data_points), sizeof(uint32_t));
-        num_data_points = reverse_bytes(num_data_points);
-
-        file.read(reinterpret_cast<char*>(&reserved1), sizeof(uint8_t));
-        file.read(reinterpret_cast<char*>(&reserved2), sizeof(uint8_t));
-
-        std::streampos current_pos = file.tellg();
-        offsets.push_back(current_pos - std::streamoff(HEADER_SIZE));
-
-        file.seekg(num_data_points * (sizeof(uint32_t) + sizeof(uint16_t)), std::ios::cur);
-    }
-
-    num_entries = offsets.size();
-    file.close();
-    return offsets;
-}
-
-// Load spike trains in parallel
-void load_spike_trains_parallel(const std::string& file_path, std::vector<std::vector<uint32_t>>& all_spike_times, std::vector<std::vector<uint16_t>>& all_neuron_indices, std::vector<uint8_t>& all_labels, const std::vector<std::streampos>& offsets) {
-    int num_entries = offsets.size();
-    all_spike_times.resize(num_entries);
-    all_neuron_indices.resize(num_entries);
-    all_labels.resize(num_entries);
-
-    #pragma omp parallel for
-    for (int i = 0; i < num_entries; ++i) {
-        std::ifstream local_file(file_path, std::ios::binary);
-        if (!local_file.is_open()) {
-            throw std::runtime_error("Could not open binary file");
-        }
-
-        local_file.seekg(offsets[i]);
-
-        uint8_t label;
-        uint16_t data_index;
-        uint32_t unique_global_id;
-        uint32_t num_data_points;
-        uint8_t reserved1;
-        uint8_t reserved2;
-
-        local_file.read(reinterpret_cast<char*>(&label), sizeof(uint8_t));
-
-        local_file.read(reinterpret_cast<char*>(&data_index), sizeof(uint16_t));
-        data_index = reverse_bytes(data_index);
-
-        local_file.read(reinterpret_cast<char*>(&unique_global_id), sizeof(uint32_t));
-        unique_global_id = reverse_bytes(unique_global_id);
-
-        local_file.read(reinterpret_cast<char*>(&num_data_points), sizeof(uint32_t));
-        num_data_points = reverse_bytes(num_data_points);
-
-        local_file.read(reinterpret_cast<char*>(&reserved1), sizeof(uint8_t));
-        local_file.read(reinterpret_cast<char*>(&reserved2), sizeof(uint8_t));
-
-        std::vector<uint32_t> spike_times(num_data_points);
-        std::vector<uint16_t> neuron_indices(num_data_points);
-
-        for (uint32_t j = 0; j < num_data_points; ++j) {
-            local_file.read(reinterpret_cast<char*>(&spike_times[j]), sizeof(uint32_t));
-            spike_times[j] = reverse_bytes(spike_times[j]);
-
-            local_file.read(reinterpret_cast<char*>(&neuron_indices[j]), sizeof(uint16_t));
-            neuron_indices[j] = reverse_bytes(neuron_indices[j]);
-        }
-
-        all_spike_times[i] = std::move(spike_times);
-        all_neuron_indices[i] = std::move(neuron_indices);
-
-        // you could change this part for another classes
-        all_labels[i] = label;
-        // all_labels[i] = label-10;
-
-        local_file.close();
-    }
-
-    // Print all information for the first data entry
-    if (!all_spike_times.empty() && !all_neuron_indices.empty()) {
-        uint8_t label;
-        uint16_t data_index;
-        uint32_t unique_global_id;
-        uint32_t num_data_points;
-        uint8_t reserved1;
-        uint8_t reserved2;
-
-        std::ifstream local_file(file_path, std::ios::binary);
-        if (!local_file.is_open()) {
-            throw std::runtime_error("Could not open binary file");
-        }
-
-        local_file.seekg(offsets[0]);
-        local_file.read(reinterpret_cast<char*>(&label), sizeof(uint8_t));
-        local_file.read(reinterpret_cast<char*>(&data_index), sizeof(uint16_t));
-        data_index = reverse_bytes(data_index);
-
-        local_file.read(reinterpret_cast<char*>(&unique_global_id), sizeof(uint32_t));
-        unique_global_id = reverse_bytes(unique_global_id);
-
-        local_file.read(reinterpret_cast<char*>(&num_data_points), sizeof(uint32_t));
-        num_data_points = reverse_bytes(num_data_points);
-
-        local_file.read(reinterpret_cast<char*>(&reserved1), sizeof(uint8_t));
-        local_file.read(reinterpret_cast<char*>(&reserved2), sizeof(uint8_t));
-
-        /*
-        std::cout << "Label: " << static_cast<int>(label) << " (" << std::bitset<8>(label) << ")\n";
-        std::cout << "Data Index: " << data_index << " (" << std::bitset<16>(data_index) << ")\n";
-        std::cout << "Unique Global ID: " << unique_global_id << " (" << std::bitset<32>(unique_global_id) << ")\n";
-        std::cout << "Num Data Points: " << num_data_points << " (" << std::bitset<32>(num_data_points) << ")\n";
-        std::cout << "Reserved1: " << static_cast<int>(reserved1) << " (" << std::bitset<8>(reserved1) << ")\n";
-        std::cout << "Reserved2: " << static_cast<int>(reserved2) << " (" << std::bitset<8>(reserved2) << ")\n";
-
-        // Print the first 10 spike times and neuron indices
-        std::cout << "First 10 spike times and neuron indices of the first entry:" << std::endl;
-        for (size_t j = 0; j < std::min(size_t(10), all_spike_times[0].size()); ++j) {
-            std::cout << "Spike Time: " << all_spike_times[0][j] << " (binary: " << std::bitset<32>(all_spike_times[0][j]) << "), Neuron Index: " << all_neuron_indices[0][j] << " (binary: " << std::bitset<16>(all_neuron_indices[0][j]) << ")" << std::endl;
-        }
-
-        // Print the last 10 spike times and neuron indices
-        std::cout << "Last 10 spike times and neuron indices of the first entry:" << std::endl;
-        for (size_t j = std::max(all_spike_times[0].size(), size_t(10)) - 10; j < all_spike_times[0].size(); ++j) {
-            std::cout << "Spike Time: " << all_spike_times[0][j] << " (binary: " << std::bitset<32>(all_spike_times[0][j]) << "), Neuron Index: " << all_neuron_indices[0][j] << " (binary: " << std::bitset<16>(all_neuron_indices[0][j]) << ")" << std::endl;
-        }
-        */
-    }
-}
-
 // Format the duration into hours, minutes, and seconds
 std::string format_duration(std::chrono::duration<double> duration) {
     auto seconds = std::chrono::duration_cast<std::chrono::seconds>(duration);
@@ -224,19 +82,33 @@ void print_progress_bar(int current, int total, const std::chrono::time_point<st
     std::cout.flush();
 }
 
-// Run the simulation and return the accuracy
-double run_simulation(Core& core_template, const std::string& file_path, int epoch, const std::string& type, int& data_count) {
+// Mean time of the last simulated step per sample, shorter than T_sim with early decisions
+template <typename Core_t>
+void print_decision_time(uint64_t decision_time_sum, int data_count, const Core_t& core) {
+    if (data_count == 0) return;
+    std::cout << "Mean decision time: " << static_cast<double>(decision_time_sum) / data_count << " (T_sim " << core.T_sim
+              << ", early_stop_margin " << core.early_stop_margin << ")" << std::endl;
+}
+
+// Run the simulation and return the accuracy.
+// A native file is read in place through its mapping. For a legacy file with prefetch_depth > 0 the
+// samples are decoded by loader_threads in the background, at most prefetch_depth ahead of the
+// simulation (see Sample_prefetcher); 0 decodes the whole file first.
+template <typename Core_t>
+double run_simulation(Core_t& core_template, const std::string& file_path, int epoch, const std::string& type, int& data_count,
+                      size_t prefetch_depth, size_t loader_threads) {
     int correct_count = 0;
+    uint64_t decision_time_sum = 0;
     bool enabling_train = (type == "train");
 
-    std::vector<std::vector<uint32_t>> all_spike_times;
-    std::vector<std::vector<uint16_t>> all_neuron_indices;
-    std::vector<uint8_t> all_labels;
-
-    int num_entries;
-    std::vector<std::streampos> offsets = calculate_offsets(file_path, num_entries);
-
-    load_spike_trains_parallel(file_path, all_spike_times, all_neuron_indices, all_labels, offsets);
+    Spike_dataset dataset(file_path);
+    size_t num_samples = std::min(dataset.size(), size_t(type == "train" ? 10000 : 1000));
+    std::unique_ptr<Sample_prefetcher> prefetcher;
+    if (prefetch_depth > 0 && !dataset.is_native()) {
+        prefetcher = std::make_unique<Sample_prefetcher>(dataset, num_samples, prefetch_depth, loader_threads);
+    } else {
+        dataset.decode_all();
+    }
 
     data_count = 0;
 
@@ -244,15 +116,16 @@ double run_simulation(Core& core_template, const std::string& file_path, int epo
 
     std::cout << "Current learning rate is " << core_template.lr << std::endl;
 
-    for (size_t i = 0; i < all_spike_times.size(); ++i) {
-        if ((type == "train" && data_count >= 10000) || (type == "test" && data_count >= 1000)) break;
-
+    for (size_t i = 0; i < num_samples; ++i) {
         core_template.reset(); // Reset neurons and spike queues
         core_template.enabling_train = enabling_train;
-        core_template.load_spike_train(all_spike_times[i], all_neuron_indices[i]);
-        core_template.class_label = all_labels[i];
+        // the core reads the sample in place, so it is released after the run
+        core_template.load_spike_train(prefetcher ? prefetcher->acquire(i) : dataset.view(i));
+        core_template.class_label = dataset.label(i);
 
         bool is_correct = core_template.run();
+        if (prefetcher) prefetcher->release(i);
+        decision_time_sum += core_template.decision_time;
 
         if (is_correct) {
             ++correct_count;
@@ -268,6 +141,179 @@ double run_simulation(Core& core_template, const std::string& file_path, int epo
     }
 
     std::cout << std::endl;
+    if (type == "test") print_decision_time(decision_time_sum, data_count, core_template);
+    return static_cast<double>(correct_count) / data_count;
+}
+
+// Mini-batch training: the samples of a batch run in parallel, one core copy per thread, against the
+// weights of core_template at the start of the batch. The copies count the learning steps of each
+// synapse instead of applying them; after the batch the counts are summed into core_template and
+// applied once, so the result does not depend on the thread count or the schedule.
+template <typename Core_t>
+double run_train_batched(Core_t& core_template, const std::string& file_path, int& data_count, size_t batch_size) {
+    Spike_dataset dataset(file_path);
+    dataset.decode_all();
+
+    size_t num_samples = std::min(dataset.size(), size_t(10000));
+    std::vector<uint8_t> correct(num_samples, 0);
+    int n_threads = core_template.num_threads > 0 ? core_template.num_threads : omp_get_max_threads();
+
+    // each sample advances PTE_slide by one, as in the sequential loop
+    size_t PTE_slide_start = core_template.PTE_slide;
+
+    std::vector<Core_t> cores(n_threads, core_template);
+    for (Core_t& core : cores) {
+        core.num_threads = 1;
+        core.enabling_train = true;
+        core.set_deferred_updates(true);
+    }
+    core_template.set_deferred_updates(true);
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    std::cout << "Current learning rate is " << core_template.lr << std::endl;
+
+    // batch whose weights each copy holds, a copy takes them with its first sample of a batch so
+    // threads left without a sample do not copy
+    std::vector<size_t> weights_batch(n_threads, SIZE_MAX);
+
+    int correct_count = 0;
+    data_count = 0;
+    for (size_t batch_start = 0; batch_start < num_samples; batch_start += batch_size) {
+        size_t batch_end = std::min(num_samples, batch_start + batch_size);
+
+        #pragma omp parallel num_threads(n_threads)
+        {
+            size_t tid = omp_get_thread_num();
+            Core_t& core = cores[tid];
+
+            #pragma omp for schedule(dynamic, 1)
+            for (size_t i = batch_start; i < batch_end; ++i) {
+                if (weights_batch[tid] != batch_start) {
+                    core.copy_weights(core_template);
+                    weights_batch[tid] = batch_start;
+                }
+                core.reset();
+                core.load_spike_train(dataset.view(i));
+                core.class_label = dataset.label(i);
+                if (core.train_phase) core.PTE_slide = (PTE_slide_start + i) % core.PTE_times;
+                correct[i] = core.run();
+            }
+        }
+
+        for (Core_t& core : cores) core_template.add_deferred_updates(core);
+        core_template.apply_deferred_updates();
+
+        for (size_t i = batch_start; i < batch_end; ++i) {
+            correct_count += correct[i];
+            ++data_count;
+            if (data_count % 1000 == 0) {
+                double current_accuracy = static_cast<double>(correct_count) / data_count;
+                std::cout << "Current accuracy after " << data_count << " data points: " << current_accuracy * 100 << "%" << std::endl;
+            }
+        }
+        print_progress_bar(data_count, 10000, start_time);
+    }
+
+    core_template.set_deferred_updates(false);
+    if (core_template.train_phase) {
+        core_template.PTE_slide = (PTE_slide_start + num_samples) % core_template.PTE_times;
+    }
+
+    std::cout << std::endl;
+    return static_cast<double>(correct_count) / data_count;
+}
+
+// Evaluate the test samples in parallel, one core copy per thread.
+// Inference does not change the weights, so every copy keeps those of core_template; each copy runs
+// its samples on one thread. Samples are handed out longest first, so a long sample does not finish
+// the pass alone, and the outcomes are counted in sample order as run_simulation does.
+// With lockstep_batch > 1 each thread runs groups of samples of similar length on a Batch_core
+// reading the weights of core_template instead.
+template <typename State, typename Weight>
+double run_test_parallel(Core<State, Weight>& core_template, const std::string& file_path, int& data_count, size_t lockstep_batch) {
+    Spike_dataset dataset(file_path);
+    dataset.decode_all();
+
+    size_t num_samples = std::min(dataset.size(), size_t(1000));
+    std::vector<size_t> order(num_samples);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return dataset.count(a) > dataset.count(b);
+    });
+
+    std::vector<uint8_t> correct(num_samples, 0);
+    std::vector<uint32_t> decision_times(num_samples, 0);
+    int n_threads = core_template.num_threads > 0 ? core_template.num_threads : omp_get_max_threads();
+    int finished = 0;
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    #pragma omp parallel num_threads(n_threads)
+    {
+        if (lockstep_batch > 1) {
+            Batch_core<State, Weight> batch_core(core_template, lockstep_batch);
+            size_t num_groups = (num_samples + lockstep_batch - 1) / lockstep_batch;
+
+            #pragma omp for schedule(dynamic, 1)
+            for (size_t g = 0; g < num_groups; ++g) {
+                size_t k_begin = g * lockstep_batch;
+                size_t k_end = std::min(num_samples, k_begin + lockstep_batch);
+                batch_core.reset();
+                for (size_t k = k_begin; k < k_end; ++k) {
+                    size_t i = order[k];
+                    batch_core.load_spike_train(k - k_begin, dataset.view(i));
+                    batch_core.class_label[k - k_begin] = dataset.label(i);
+                }
+                batch_core.run();
+                for (size_t k = k_begin; k < k_end; ++k) {
+                    correct[order[k]] = batch_core.correct[k - k_begin];
+                    decision_times[order[k]] = batch_core.decision_time[k - k_begin];
+                }
+
+                int count;
+                #pragma omp atomic capture
+                count = finished += static_cast<int>(k_end - k_begin);
+                if (omp_get_thread_num() == 0) print_progress_bar(count, 1000, start_time);
+            }
+        } else {
+            Core<State, Weight> core(core_template);
+            core.num_threads = 1;
+            core.enabling_train = false;
+
+            #pragma omp for schedule(dynamic, 1)
+            for (size_t k = 0; k < num_samples; ++k) {
+                size_t i = order[k];
+                core.reset();
+                core.load_spike_train(dataset.view(i));
+                core.class_label = dataset.label(i);
+                correct[i] = core.run();
+                decision_times[i] = core.decision_time;
+
+                int count;
+                #pragma omp atomic capture
+                count = ++finished;
+                if (omp_get_thread_num() == 0) print_progress_bar(count, 1000, start_time);
+            }
+        }
+    }
+    print_progress_bar(finished, 1000, start_time);
+
+    int correct_count = 0;
+    uint64_t decision_time_sum = 0;
+    data_count = 0;
+    for (size_t i = 0; i < num_samples; ++i) {
+        correct_count += correct[i];
+        decision_time_sum += decision_times[i];
+        ++data_count;
+        if (data_count % 1000 == 0) {
+            double current_accuracy = static_cast<double>(correct_count) / data_count;
+            std::cout << "Current accuracy after " << data_count << " data points: " << current_accuracy * 100 << "%" << std::endl;
+        }
+    }
+
+    std::cout << std::endl;
+    print_decision_time(decision_time_sum, data_count, core_template);
     return static_cast<double>(correct_count) / data_count;
 }
 
@@ -302,6 +348,68 @@ void save_accuracy_to_file(const std::string& filename, int epoch, double train_
     file.close();
 }
 
+// Train and test over the epochs with a core of the given state and weight types
+template <typename State, typename Weight>
+void run_epochs(const std::string& param_file, const std::string& weights_file, const std::vector<int>& tau_values, int T_sim, double lr,
+                int num_epochs, int N_chunks, const std::string& base_train_file_path, const std::string& train_file_ext, const std::string& test_file_path,
+                size_t batch_size, bool parallel_test, size_t lockstep_batch, size_t prefetch_depth, size_t loader_threads, const std::string& accuracy_file, const std::chrono::time_point<std::chrono::high_resolution_clock>& program_start) {
+    // initialization of the core
+    Core<State, Weight> core_template(param_file, weights_file, tau_values);
+    core_template.T_sim = T_sim;
+    core_template.lr = lr;
+    // fixed point weights learn in steps of one LSB or more
+    double w_step = Scalar_traits<Weight>::to_real(core_template.learning_step());
+    if (std::abs(w_step - lr * 0.1) > 0.25 * lr * 0.1) {
+        std::cout << "Warning: learning step lr * 0.1 = " << lr * 0.1 << " is applied as " << w_step << " in this precision" << std::endl;
+    }
+
+    for (int epoch = 0; epoch < num_epochs; ++epoch) {
+        auto epoch_start = std::chrono::high_resolution_clock::now();
+
+        if (epoch > 0) {
+            if (fs::exists("./training_weights.json")) {
+                core_template.load_weights("./training_weights.json");
+                std::cout << "Loaded weights for epoch " << epoch << std::endl;
+            }
+        }
+
+        print_epoch_progress(epoch, num_epochs, program_start);
+
+        std::cout << "\nStarting training epoch " << epoch << "...\n";
+
+        int chunk_index = epoch % N_chunks;
+        std::cout << chunk_index << "...\n";
+        if (core_template.train_phase) {
+            core_template.PTE_slide = (epoch / N_chunks) % core_template.PTE_times;
+        }
+        std::stringstream ss;
+        ss << base_train_file_path << chunk_index << train_file_ext;
+        std::string train_file_path = ss.str();
+
+        int train_data_count;
+        int test_data_count;
+
+        double train_result = batch_size > 1 ? run_train_batched(core_template, train_file_path, train_data_count, batch_size)
+                                             : run_simulation(core_template, train_file_path, epoch, "train", train_data_count, prefetch_depth, loader_threads);
+        std::cout << "Epoch " << epoch << " training accuracy: " << train_result * 100 << "%" << " with " << train_data_count << " data points." << std::endl;
+
+        if (epoch % 5 == 0) {
+            std::cout << "Starting testing epoch " << epoch << "...\n";
+
+            double test_result = parallel_test ? run_test_parallel(core_template, test_file_path, test_data_count, lockstep_batch)
+                                               : run_simulation(core_template, test_file_path, epoch, "test", test_data_count, prefetch_depth, loader_threads);
+            std::cout << "Epoch " << epoch << " test accuracy: " << test_result * 100 << "%" << " with " << test_data_count << " data points." << std::endl;
+            auto epoch_end = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> epoch_duration = epoch_end - epoch_start;
+            std::cout << "Epoch " << epoch << " duration: " << format_duration(epoch_duration) << ".\n";
+
+            save_accuracy_to_file(accuracy_file, epoch, train_result * 100, test_result * 100);
+        }
+
+        core_template.save_weights("./training_weights.json");
+    }
+}
+
 int main(int argc, char *argv[]) {
     auto program_start = std::chrono::high_resolution_clock::now();
 
@@ -322,16 +430,28 @@ int main(int argc, char *argv[]) {
 
     int num_epochs = param_json["system_parameter"]["epoch"].get<int>();
     std::string base_train_file_path = param_json["system_parameter"]["training_file"].get<std::string>();
+    std::string train_file_ext = param_json["system_parameter"].value("training_file_ext", std::string(".bin"));
     std::string test_file_path = param_json["system_parameter"]["test_file"].get<std::string>();
     int T_sim = param_json["system_parameter"]["T_sim"].get<int>();
     double lr = param_json["system_parameter"]["lr"].get<double>();
     int N_chunks = param_json["system_parameter"]["N_chunks"].get<int>();
+    bool parallel_test = param_json["system_parameter"].value("parallel_test", true);
+    size_t lockstep_batch = param_json["system_parameter"].value("lockstep_batch", size_t(1));
+    size_t batch_size = param_json["system_parameter"].value("batch_size", size_t(1));
+    if (batch_size == 0) {
+        throw std::runtime_error("batch_size cannot be zero");
+    }
+    size_t prefetch_depth = param_json["system_parameter"].value("prefetch_depth", size_t(8));
+    size_t loader_threads = param_json["system_parameter"].value("loader_threads", size_t(1));
 
     std::cout << "Loaded system parameters:" << std::endl;
     std::cout << "Epochs: " << num_epochs << std::endl;
-    std::cout << "Training file path: " << base_train_file_path << std::endl;
+    std::cout << "Training file path: " << base_train_file_path << "<chunk>" << train_file_ext << std::endl;
     std::cout << "Test file path: " << test_file_path << std::endl;
     std::cout << "Simulation time (T_sim): " << T_sim << std::endl;
+    std::cout << "Batch size: " << batch_size << std::endl;
+    std::cout << "Parallel test: " << parallel_test << ", lockstep batch: " << lockstep_batch << std::endl;
+    std::cout << "Prefetch depth: " << prefetch_depth << ", loader threads: " << loader_threads << std::endl;
 
     std::cout << "version: " <<  __GIT_REV__ << std::endl;
     std::cout << "CXX: " <<  __VERSION__ << std::endl;
@@ -353,53 +473,16 @@ int main(int argc, char *argv[]) {
         file.close();
     }
 
-    // initialization of the core
-    Core core_template(param_file, weights_file, tau_values);
-    core_template.T_sim = T_sim;
-    core_template.lr = lr;
-
-    for (int epoch = 0; epoch < num_epochs; ++epoch) {
-        auto epoch_start = std::chrono::high_resolution_clock::now();
-
-        if (epoch > 0) {
-            if (fs::exists("./training_weights.json")) {
-                core_template.load_weights("./training_weights.json");
-                std::cout << "Loaded weights for epoch " << epoch << std::endl;
-            }
-        }
-
-        print_epoch_progress(epoch, num_epochs, program_start);
-
-        std::cout << "\nStarting training epoch " << epoch << "...\n";
-
-        int chunk_index = epoch % N_chunks;
-        std::cout << chunk_index << "...\n";
-#if defined(TRAIN_PHASE)
-        core_template.PTE_slide = (epoch / N_chunks) % core_template.PTE_times;
-#endif
-        std::stringstream ss;
-        ss << base_train_file_path << chunk_index << ".bin";
-        std::string train_file_path = ss.str();
-
-        int train_data_count;
-        int test_data_count;
-
-        double train_result = run_simulation(core_template, train_file_path, epoch, "train", train_data_count);
-        std::cout << "Epoch " << epoch << " training accuracy: " << train_result * 100 << "%" << " with " << train_data_count << " data points." << std::endl;
-
-        if (epoch % 5 == 0) {
-            std::cout << "Starting testing epoch " << epoch << "...\n";
-
-            double test_result = run_simulation(core_template, test_file_path, epoch, "test", test_data_count);
-            std::cout << "Epoch " << epoch << " test accuracy: " << test_result * 100 << "%" << " with " << test_data_count << " data points." << std::endl;
-            auto epoch_end = std::chrono::high_resolution_clock::now();
-            std::chrono::duration<double> epoch_duration = epoch_end - epoch_start;
-            std::cout << "Epoch " << epoch << " duration: " << format_duration(epoch_duration) << ".\n";
-
-            save_accuracy_to_file(accuracy_file, epoch, train_result * 100, test_result * 100);
-        }
-
-        core_template.save_weights("./training_weights.json");
+    std::string precision = param_json["core_parameter"].value("precision", std::string("double"));
+    std::cout << "Precision: " << precision << std::endl;
+    if (precision == "double") {
+        run_epochs<double, double>(param_file, weights_file, tau_values, T_sim, lr, num_epochs, N_chunks, base_train_file_path, train_file_ext, test_file_path, batch_size, parallel_test, lockstep_batch, prefetch_depth, loader_threads, accuracy_file, program_start);
+    } else if (precision == "float") {
+        run_epochs<float, float>(param_file, weights_file, tau_values, T_sim, lr, num_epochs, N_chunks, base_train_file_path, train_file_ext, test_file_path, batch_size, parallel_test, lockstep_batch, prefetch_depth, loader_threads, accuracy_file, program_start);
+    } else if (precision == "fixed") {
+        run_epochs<int16_t, int8_t>(param_file, weights_file, tau_values, T_sim, lr, num_epochs, N_chunks, base_train_file_path, train_file_ext, test_file_path, batch_size, parallel_test, lockstep_batch, prefetch_depth, loader_threads, accuracy_file, program_start);
+    } else {
+        throw std::runtime_error("Unknown precision: " + precision);
     }
 
     struct rusage usage;
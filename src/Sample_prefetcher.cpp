@@ -0,0 +1,72 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#include "Sample_prefetcher.h"
+#include <algorithm>
+#include <stdexcept>
+
+Sample_prefetcher::Sample_prefetcher(const Spike_dataset& dataset, size_t n_samples, size_t depth, size_t n_loaders)
+    : dataset(dataset), n_samples(n_samples), stride(std::max<size_t>(1, std::min(n_loaders, depth))) {
+    if (depth == 0) {
+        throw std::runtime_error("prefetch depth cannot be zero");
+    }
+    slots.resize(depth);
+    for (size_t k = 0; k < stride && k < n_samples; ++k) {
+        loaders.emplace_back(&Sample_prefetcher::load, this, k);
+    }
+}
+
+Sample_prefetcher::~Sample_prefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    free_cv.notify_all();
+    for (std::thread& t : loaders) t.join();
+}
+
+void Sample_prefetcher::load(size_t first) {
+    for (size_t i = first; i < n_samples; i += stride) {
+        Slot& slot = slots[i % slots.size()];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            free_cv.wait(lock, [&] { return stopping || i < released + slots.size(); });
+            if (stopping) return;
+        }
+
+        // the slot is ours until it is marked ready
+        try {
+            slot.times.resize(dataset.count(i));
+            slot.ids.resize(dataset.count(i));
+            dataset.decode(i, slot.times.data(), slot.ids.data());
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::current_exception();
+            ready_cv.notify_all();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot.sample = i;
+            slot.ready = true;
+        }
+        ready_cv.notify_all();
+    }
+}
+
+Spike_train_view Sample_prefetcher::acquire(size_t i) {
+    Slot& slot = slots[i % slots.size()];
+    std::unique_lock<std::mutex> lock(mutex);
+    ready_cv.wait(lock, [&] { return error || (slot.ready && slot.sample == i); });
+    if (error) std::rethrow_exception(error);
+    return {slot.times.data(), slot.ids.data(), slot.times.size()};
+}
+
+void Sample_prefetcher::release(size_t i) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        slots[i % slots.size()].ready = false;
+        released = i + 1;
+    }
+    free_cv.notify_all();
+}
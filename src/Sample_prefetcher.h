@@ -0,0 +1,55 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#ifndef SAMPLE_PREFETCHER_H
+#define SAMPLE_PREFETCHER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Spike.h"
+#include "Spike_dataset.h"
+
+// Loader threads decode the first n_samples entries of a dataset, in order, into a ring of `depth`
+// spike trains while the caller simulates. Sample i goes to slot i % depth, so a loader waits until
+// sample i - depth has been released (backpressure), and at most depth samples are decoded at a time
+// whatever the size of the dataset.
+// One consumer takes the samples in order: acquire(i), run on the view, release(i).
+class Sample_prefetcher {
+public:
+    Sample_prefetcher(const Spike_dataset& dataset, size_t n_samples, size_t depth, size_t n_loaders);
+    ~Sample_prefetcher();
+    Sample_prefetcher(const Sample_prefetcher&) = delete;
+    Sample_prefetcher& operator=(const Sample_prefetcher&) = delete;
+
+    // Wait for sample i, the view is valid until release(i)
+    Spike_train_view acquire(size_t i);
+    void release(size_t i);
+
+private:
+    struct Slot {
+        std::vector<uint32_t> times;
+        std::vector<uint16_t> ids;
+        size_t sample = 0;
+        bool ready = false;
+    };
+
+    void load(size_t first);
+
+    const Spike_dataset& dataset;
+    size_t n_samples;
+    size_t stride;                  // number of loaders, loader k decodes samples k, k + stride, ...
+    std::vector<Slot> slots;
+    size_t released = 0;            // samples [0, released) are done with
+    bool stopping = false;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable ready_cv;
+    std::condition_variable free_cv;
+    std::vector<std::thread> loaders;
+};
+
+#endif // SAMPLE_PREFETCHER_H
@@ -0,0 +1,56 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#ifndef SCALAR_TRAITS_H
+#define SCALAR_TRAITS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+// Number formats a Core can be instantiated with, for membrane state and weights.
+// Floating types hold real values.
+// Integer types are fixed point with one LSB = 0.1 / 127 shared by weights and potentials:
+// the ±0.1 weight clamp is the full int8 range and weight rows add into membranes without rescaling.
+// Fixed point arithmetic saturates at the limits of the type. A fixed point potential keeps
+// frac_bits below its LSB across leaks, so leaks of less than one LSB per tick still add up.
+template <typename T, typename Enable = void>
+struct Scalar_traits {
+    using acc_t = T;        // sum of the inputs of a step
+    using decay_t = T;      // leak factor
+    static constexpr bool is_fixed = false;
+
+    static T from_real(double x) { return static_cast<T>(x); }
+    static double to_real(T x) { return static_cast<double>(x); }
+    static T saturate(acc_t x) { return x; }
+    static decay_t decay_factor(double f) { return static_cast<decay_t>(f); }
+    static T decay(T v, decay_t f) { return v * f; }
+};
+
+template <typename T>
+struct Scalar_traits<T, std::enable_if_t<std::is_integral<T>::value>> {
+    using acc_t = int32_t;
+    using decay_t = int32_t;    // Q30, 1 << decay_shift is 1.0
+    static constexpr bool is_fixed = true;
+    static constexpr double lsb = 0.1 / 127;
+    static constexpr int decay_shift = 30;
+    static constexpr int frac_bits = 16;
+
+    static T saturate(int64_t x) {
+        return static_cast<T>(std::min<int64_t>(std::max<int64_t>(x, std::numeric_limits<T>::min()), std::numeric_limits<T>::max()));
+    }
+    static T from_real(double x) { return saturate(std::llround(x / lsb)); }
+    static double to_real(T x) { return x * lsb; }
+    static decay_t decay_factor(double f) { return static_cast<decay_t>(std::llround(f * (int64_t(1) << decay_shift))); }
+    // Decay v + frac / 2^frac_bits by f and put the bits below the LSB back into frac.
+    // Truncated toward zero, so with f < 1 a nonzero potential shrinks at every tick and |result| <= |v|.
+    static T decay(T v, uint16_t& frac, decay_t f) {
+        int64_t x = static_cast<int64_t>(v) * (int64_t(1) << frac_bits) + frac;
+        x = x * f / (int64_t(1) << decay_shift);
+        frac = static_cast<uint16_t>(x & ((int64_t(1) << frac_bits) - 1));
+        return static_cast<T>(x >> frac_bits);
+    }
+};
+
+#endif // SCALAR_TRAITS_H
@@ -0,0 +1,72 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#include "Sparse_matrix.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+template <typename T>
+Sparse_matrix<T>::Sparse_matrix() : row_ptr(1, 0), n_cols(0) {}
+
+// Build from a dense matrix
+template <typename T>
+Sparse_matrix<T>::Sparse_matrix(const std::vector<std::vector<T>>& dense)
+    : row_ptr(1, 0), n_cols(dense.empty() ? 0 : dense[0].size()) {
+    row_ptr.reserve(dense.size() + 1);
+    for (const auto& row : dense) {
+        for (size_t j = 0; j < row.size(); ++j) {
+            if (row[j] != T(0)) {
+                col_idx.push_back(static_cast<uint32_t>(j));
+                val.push_back(row[j]);
+            }
+        }
+        row_ptr.push_back(static_cast<uint32_t>(val.size()));
+    }
+}
+
+template <typename T>
+double Sparse_matrix<T>::density(const std::vector<std::vector<T>>& dense) {
+    size_t n_total = 0;
+    size_t n_nonzero = 0;
+    for (const auto& row : dense) {
+        n_total += row.size();
+        n_nonzero += std::count_if(row.begin(), row.end(), [](T w) { return w != T(0); });
+    }
+    return n_total == 0 ? 0.0 : static_cast<double>(n_nonzero) / n_total;
+}
+
+template <typename T>
+T* Sparse_matrix<T>::find(size_t row, size_t col) {
+    auto begin = col_idx.begin() + row_ptr[row];
+    auto end = col_idx.begin() + row_ptr[row + 1];
+    auto it = std::lower_bound(begin, end, static_cast<uint32_t>(col));
+    if (it == end || *it != col) return nullptr;
+    return &val[it - col_idx.begin()];
+}
+
+template <typename T>
+void Sparse_matrix<T>::assign(const std::vector<std::vector<T>>& dense) {
+    if (dense.size() != rows() || (!dense.empty() && dense[0].size() != n_cols)) {
+        throw std::runtime_error("Sparse_matrix::assign shape mismatch");
+    }
+    for (size_t i = 0; i < rows(); ++i) {
+        for (uint32_t k = row_ptr[i]; k < row_ptr[i + 1]; ++k) {
+            val[k] = dense[i][col_idx[k]];
+        }
+    }
+}
+
+template <typename T>
+std::vector<std::vector<T>> Sparse_matrix<T>::to_dense() const {
+    std::vector<std::vector<T>> dense(rows(), std::vector<T>(n_cols, T(0)));
+    for (size_t i = 0; i < rows(); ++i) {
+        for (uint32_t k = row_ptr[i]; k < row_ptr[i + 1]; ++k) {
+            dense[i][col_idx[k]] = val[k];
+        }
+    }
+    return dense;
+}
+
+template class Sparse_matrix<double>;
+template class Sparse_matrix<float>;
+template class Sparse_matrix<int8_t>;
@@ -0,0 +1,43 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#ifndef SPARSE_MATRIX_H
+#define SPARSE_MATRIX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Aligned_allocator.h"
+
+// Weight matrix in CSR form, row = presynaptic neuron, column = postsynaptic neuron.
+// Zero entries of the dense matrix are not synapses and are dropped,
+// column indices are sorted within each row.
+// Instantiated in Sparse_matrix.cpp for the weight types of Core.
+template <typename T>
+class Sparse_matrix {
+public:
+    Sparse_matrix();
+    explicit Sparse_matrix(const std::vector<std::vector<T>>& dense);
+
+    size_t rows() const { return row_ptr.size() - 1; }
+    size_t cols() const { return n_cols; }
+    size_t nnz() const { return val.size(); }
+
+    // Fraction of non-zero entries of a dense matrix
+    static double density(const std::vector<std::vector<T>>& dense);
+
+    // Stored weight of (row, col), nullptr if there is no synapse
+    T* find(size_t row, size_t col);
+
+    // Refill the values from a dense matrix of the same shape, keeping the sparsity pattern
+    void assign(const std::vector<std::vector<T>>& dense);
+    std::vector<std::vector<T>> to_dense() const;
+
+    aligned_vector<uint32_t> row_ptr;   // entries of row r are [row_ptr[r], row_ptr[r + 1])
+    aligned_vector<uint32_t> col_idx;
+    aligned_vector<T> val;
+
+private:
+    size_t n_cols;
+};
+
+#endif // SPARSE_MATRIX_H
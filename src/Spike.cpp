@@ -2,20 +2,79 @@
 // SPDX-License-Identifier: Apache-2.0
 #include "Spike.h"
 
-// Constructor
-// example of Neu_id: # of neuron, site (0, 'i') or (0, 'r').
-// 'i' is 'input' and 'r' is 'reservoir'
-// or 'f' is 'forward' (A side of CBA) and 'b' is 'hidden' (b side of CBA)
-Spike::Spike(uint32_t time, std::pair<size_t, char> id) : time(time), id(id) {}
-
-// Comparison operator for priority queue
-bool Spike::operator<(const Spike& other) const {
-    return time > other.time;  // Higher priority for earlier times
+#include <algorithm>
+#include <numeric>
+
+Spike_input::Spike_input() : times(nullptr), ids(nullptr), size(0), cursor(0) {}
+
+// A copy reads its own copy of the train, or the same view
+Spike_input::Spike_input(const Spike_input& other)
+    : times(other.times), ids(other.ids), size(other.size), cursor(other.cursor), own_times(other.own_times), own_ids(other.own_ids) {
+    if (other.times == other.own_times.data()) {
+        times = own_times.data();
+        ids = own_ids.data();
+    }
+}
+
+Spike_input& Spike_input::operator=(const Spike_input& other) {
+    if (this != &other) {
+        own_times = other.own_times;
+        own_ids = other.own_ids;
+        bool own = other.times == other.own_times.data();
+        times = own ? own_times.data() : other.times;
+        ids = own ? own_ids.data() : other.ids;
+        size = other.size;
+        cursor = other.cursor;
+    }
+    return *this;
+}
+
+// Load a spike train, the caller's vectors may go away before it is consumed so they are copied
+void Spike_input::load(const std::vector<uint32_t>& spike_times, const std::vector<uint16_t>& neuron_indices) {
+    load(Spike_train_view{spike_times.data(), neuron_indices.data(), spike_times.size()});
+    if (times != own_times.data()) {
+        own_times.assign(spike_times.begin(), spike_times.end());
+        own_ids.assign(neuron_indices.begin(), neuron_indices.end());
+        times = own_times.data();
+        ids = own_ids.data();
+    }
 }
 
-Spike_input::Spike_input(uint32_t time, uint16_t id) : time(time), id(id){}
+// The dataset is already in time order, so the view is read in place and sorting a copy is only a fallback
+void Spike_input::load(const Spike_train_view& train) {
+    cursor = 0;
+    size = train.size;
+    if (std::is_sorted(train.times, train.times + train.size)) {
+        times = train.times;
+        ids = train.ids;
+        return;
+    }
+
+    std::vector<size_t> order(train.size);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return train.times[a] < train.times[b]; });
+
+    own_times.resize(order.size());
+    own_ids.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        own_times[i] = train.times[order[i]];
+        own_ids[i] = train.ids[order[i]];
+    }
+    times = own_times.data();
+    ids = own_ids.data();
+}
+
+void Spike_input::clear() {
+    times = nullptr;
+    ids = nullptr;
+    size = 0;
+    cursor = 0;
+}
 
-// Comparison operator for priority queue
-bool Spike_input::operator<(const Spike_input& other) const {
-    return time > other.time;  // Higher priority for earlier times
+std::pair<size_t, size_t> Spike_input::advance(uint32_t T_now) {
+    size_t begin = cursor;
+    while (cursor < size && times[cursor] <= T_now) {
+        ++cursor;
+    }
+    return {begin, cursor};
 }
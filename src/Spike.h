@@ -6,25 +6,64 @@
 #include <cstddef>  // for size_t
 #include <cstdint>
 #include <utility>
+#include <vector>
 
+// Spike packed in 8 bytes: the time and a tag holding the layer (high 8 bits) and the neuron
+// index (low 24 bits).
+// example of id: # of neuron, site (0, 'i') or (0, 'r').
+// 'i' is 'input' and 'r' is 'reservoir'
+// or 'f' is 'forward' (A side of CBA) and 'b' is 'hidden' (b side of CBA)
 class Spike {
 public:
-    Spike(uint32_t time, std::pair<size_t, char> id);
+    static constexpr size_t max_index = (size_t(1) << 24) - 1;
 
-    bool operator<(const Spike& other) const;
+    Spike() = default;
+    Spike(uint32_t time, std::pair<size_t, char> id)
+        : time(time), tag((static_cast<uint32_t>(static_cast<uint8_t>(id.second)) << 24) | static_cast<uint32_t>(id.first & max_index)) {}
+
+    size_t index() const { return tag & max_index; }
+    char layer() const { return static_cast<char>(tag >> 24); }
 
     uint32_t time;
-    std::pair<size_t, char> id;
+    uint32_t tag;
+};
+
+// Spike train of one sample stored elsewhere (see Spike_dataset), times and neuron indices
+struct Spike_train_view {
+    const uint32_t* times;
+    const uint16_t* ids;
+    size_t size;
 };
 
+// Input spike train of one sample as flat time-sorted arrays.
+// run_loop consumes it frame by frame (all spikes sharing a timestamp) through a cursor.
+// A view already in time order is read in place and has to stay valid until the train is
+// consumed or cleared; vectors and unsorted views are copied.
 class Spike_input {
 public:
-    Spike_input(uint32_t time, uint16_t id);
+    Spike_input();
+    Spike_input(const Spike_input& other);
+    Spike_input& operator=(const Spike_input& other);
 
-    bool operator<(const Spike_input& other) const;
+    void load(const std::vector<uint32_t>& spike_times, const std::vector<uint16_t>& neuron_indices);
+    void load(const Spike_train_view& train);
+    void clear();
 
-    uint32_t time;
-    uint16_t id;
+    bool empty() const { return cursor == size; }
+    uint32_t next_time() const { return times[cursor]; }
+
+    // Move the cursor past every spike with time <= T_now, returns the consumed frame [begin, end)
+    std::pair<size_t, size_t> advance(uint32_t T_now);
+
+    const uint32_t* times;
+    const uint16_t* ids;
+    size_t size;
+    size_t cursor;
+
+private:
+    // Copy of the train when it is not read in place
+    std::vector<uint32_t> own_times;
+    std::vector<uint16_t> own_ids;
 };
 
 #endif // SPIKE_H
@@ -0,0 +1,197 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#include "Spike_dataset.h"
+#include "Kernels.h"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t HEADER_SIZE = 13;  // bytes
+const size_t RECORD_SIZE = 6;   // time u32 and neuron index u16
+
+// The native file is read and written in host order (header and entries copied, columns viewed in
+// place), which is its little-endian layout only on a little-endian host
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__)
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the native spike format needs a little-endian host");
+#else
+#error "cannot tell the byte order of the host, the native spike format needs a little-endian host"
+#endif
+static_assert(sizeof(Spike_dataset::Native_header) == 64, "native header is 64 bytes");
+static_assert(sizeof(Spike_dataset::Native_entry) == 16, "native entry is 16 bytes");
+
+uint32_t read_be32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+size_t align_up(size_t n, size_t a) {
+    return (n + a - 1) / a * a;
+}
+
+} // namespace
+
+Spike_dataset::Spike_dataset(const std::string& file_path) {
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open binary file");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not read binary file size");
+    }
+    file_size = static_cast<size_t>(st.st_size);
+    if (file_size > 0) {
+        void* p = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Could not map binary file");
+        }
+        data = static_cast<const uint8_t*>(p);
+    }
+    close(fd);
+
+    native = file_size >= sizeof(Native_header) && std::memcmp(data, native_magic, sizeof(native_magic)) == 0;
+    try {
+        if (native) {
+            index_native();
+        } else {
+            advise_sequential(true);
+            index_legacy();
+            advise_sequential(false);
+        }
+    } catch (...) {
+        munmap(const_cast<uint8_t*>(data), file_size);
+        throw;
+    }
+}
+
+Spike_dataset::~Spike_dataset() {
+    if (data != nullptr) munmap(const_cast<uint8_t*>(data), file_size);
+}
+
+// label u8, data index u16, global id u32, number of spikes u32 at byte 7, reserved u8 x2
+void Spike_dataset::index_legacy() {
+    size_t pos = 0;
+    size_t first = 0;
+    while (pos + HEADER_SIZE <= file_size) {
+        Entry e;
+        e.label = data[pos];
+        e.count = read_be32(data + pos + 7);
+        e.offset = pos + HEADER_SIZE;
+        e.first = first;
+        if (e.count > (file_size - e.offset) / RECORD_SIZE) {
+            throw std::runtime_error("Truncated entry in binary file");
+        }
+        entries.push_back(e);
+        first += e.count;
+        pos = e.offset + e.count * RECORD_SIZE;
+    }
+}
+
+// Read-ahead for the passes over a whole legacy file. Otherwise the mapping keeps the default
+// advice, since native views and single decodes may come in any order (e.g. longest first).
+void Spike_dataset::advise_sequential(bool on) const {
+    if (data == nullptr) return;
+    madvise(const_cast<uint8_t*>(data), file_size, on ? MADV_SEQUENTIAL : MADV_NORMAL);
+}
+
+void Spike_dataset::index_native() {
+    Native_header h;
+    std::memcpy(&h, data, sizeof(h));
+    if (h.version != native_version) {
+        throw std::runtime_error("Unsupported native spike file version");
+    }
+    bool fits = h.table_offset <= file_size && h.n_entries <= (file_size - h.table_offset) / sizeof(Native_entry)
+             && h.times_offset <= file_size && h.n_spikes <= (file_size - h.times_offset) / sizeof(uint32_t)
+             && h.ids_offset <= file_size && h.n_spikes <= (file_size - h.ids_offset) / sizeof(uint16_t);
+    if (!fits || h.times_offset % alignof(uint32_t) != 0 || h.ids_offset % alignof(uint16_t) != 0) {
+        throw std::runtime_error("Corrupt native spike file header");
+    }
+
+    entries.resize(h.n_entries);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        Native_entry ne;
+        std::memcpy(&ne, data + h.table_offset + i * sizeof(Native_entry), sizeof(ne));
+        if (ne.first > h.n_spikes || ne.count > h.n_spikes - ne.first) {
+            throw std::runtime_error("Corrupt native spike file entry");
+        }
+        entries[i] = {0, ne.count, static_cast<size_t>(ne.first), ne.label};
+    }
+    times_col = reinterpret_cast<const uint32_t*>(data + h.times_offset);
+    ids_col = reinterpret_cast<const uint16_t*>(data + h.ids_offset);
+}
+
+void Spike_dataset::decode(size_t i, uint32_t* times_out, uint16_t* ids_out) const {
+    const Entry& e = entries[i];
+    if (native) {
+        std::memcpy(times_out, times_col + e.first, e.count * sizeof(uint32_t));
+        std::memcpy(ids_out, ids_col + e.first, e.count * sizeof(uint16_t));
+        return;
+    }
+    decode_spike_records(data + e.offset, e.count, times_out, ids_out);
+}
+
+void Spike_dataset::decode_all() {
+    if (native || times_col != nullptr) return;
+    size_t total = entries.empty() ? 0 : entries.back().first + entries.back().count;
+    times.resize(total);
+    ids.resize(total);
+    advise_sequential(true);
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (size_t i = 0; i < entries.size(); ++i) {
+        decode(i, times.data() + entries[i].first, ids.data() + entries[i].first);
+    }
+    advise_sequential(false);
+    times_col = times.data();
+    ids_col = ids.data();
+}
+
+Spike_train_view Spike_dataset::view(size_t i) const {
+    const Entry& e = entries[i];
+    return {times_col + e.first, ids_col + e.first, e.count};
+}
+
+void Spike_dataset::save_native(const std::string& file_path) {
+    decode_all();
+    size_t n_spikes = entries.empty() ? 0 : entries.back().first + entries.back().count;
+
+    Native_header h = {};
+    std::memcpy(h.magic, native_magic, sizeof(native_magic));
+    h.version = native_version;
+    h.alignment = native_alignment;
+    h.n_entries = entries.size();
+    h.n_spikes = n_spikes;
+    h.table_offset = sizeof(Native_header);
+    h.times_offset = align_up(h.table_offset + entries.size() * sizeof(Native_entry), native_alignment);
+    h.ids_offset = align_up(h.times_offset + n_spikes * sizeof(uint32_t), native_alignment);
+
+    std::ofstream out(file_path, std::ios::binary);
+    if (!out.is_open()) {
+        throw std::runtime_error("Could not open output file");
+    }
+    const char zeros[native_alignment] = {};
+    auto pad_to = [&](size_t offset) {
+        out.write(zeros, static_cast<std::streamsize>(offset - static_cast<size_t>(out.tellp())));
+    };
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    for (const Entry& e : entries) {
+        Native_entry ne = {};
+        ne.first = e.first;
+        ne.count = static_cast<uint32_t>(e.count);
+        ne.label = e.label;
+        out.write(reinterpret_cast<const char*>(&ne), sizeof(ne));
+    }
+    pad_to(h.times_offset);
+    out.write(reinterpret_cast<const char*>(times_col), static_cast<std::streamsize>(n_spikes * sizeof(uint32_t)));
+    pad_to(h.ids_offset);
+    out.write(reinterpret_cast<const char*>(ids_col), static_cast<std::streamsize>(n_spikes * sizeof(uint16_t)));
+    if (!out) {
+        throw std::runtime_error("Could not write output file");
+    }
+}
@@ -0,0 +1,92 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#ifndef SPIKE_DATASET_H
+#define SPIKE_DATASET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Spike.h"
+
+// Spike dataset file, mapped once with mmap. Two formats are read, told apart by the magic:
+//
+// Legacy .bin: each entry is a 13-byte big-endian header (label u8, data index u16, global id u32,
+// number of spikes u32, two reserved bytes) followed by its spikes as big-endian records of time
+// u32 and neuron index u16. The entry index is built in one pass over the headers; decode_all
+// splits every entry into flat host-order arrays that view() points into.
+//
+// Native (.smsd, see save_native), little-endian, read and written only on little-endian hosts:
+//   header       Native_header (64 bytes)
+//   entry table  Native_entry[n_entries] (16 bytes each)
+//   times        uint32_t[n_spikes], at a multiple of 64 bytes
+//   ids          uint16_t[n_spikes], at a multiple of 64 bytes
+// The columns hold the entries back to back in table order. view() points into the mapping, so
+// nothing is decoded or copied.
+class Spike_dataset {
+public:
+    static constexpr char native_magic[8] = {'S', 'M', 'S', 'P', 'I', 'K', 'E', 'S'};
+    static constexpr uint32_t native_version = 1;
+    static constexpr size_t native_alignment = 64;
+
+    struct Native_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t alignment;
+        uint64_t n_entries;
+        uint64_t n_spikes;
+        uint64_t table_offset;
+        uint64_t times_offset;
+        uint64_t ids_offset;
+        uint8_t reserved[8];
+    };
+    struct Native_entry {
+        uint64_t first;     // of the entry in the columns
+        uint32_t count;
+        uint8_t label;
+        uint8_t reserved[3];
+    };
+
+    explicit Spike_dataset(const std::string& file_path);
+    ~Spike_dataset();
+    Spike_dataset(const Spike_dataset&) = delete;
+    Spike_dataset& operator=(const Spike_dataset&) = delete;
+
+    bool is_native() const { return native; }
+    size_t size() const { return entries.size(); }
+    uint8_t label(size_t i) const { return entries[i].label; }
+    size_t count(size_t i) const { return entries[i].count; }
+
+    // Decode entry i into times[0, count(i)) and ids[0, count(i))
+    void decode(size_t i, uint32_t* times, uint16_t* ids) const;
+    // Decode every entry of a legacy file (in parallel), then view(i) is valid.
+    // Nothing to do for a native file.
+    void decode_all();
+    Spike_train_view view(size_t i) const;
+
+    // Write the dataset in the native format, a legacy file is decoded first
+    void save_native(const std::string& file_path);
+
+private:
+    struct Entry {
+        size_t offset;  // of the first record in a legacy file
+        size_t count;
+        size_t first;   // of the entry in the columns
+        uint8_t label;
+    };
+
+    const uint8_t* data = nullptr;
+    size_t file_size = 0;
+    bool native = false;
+    std::vector<Entry> entries;
+    std::vector<uint32_t> times;        // decoded columns of a legacy file
+    std::vector<uint16_t> ids;
+    const uint32_t* times_col = nullptr;
+    const uint16_t* ids_col = nullptr;
+
+    void index_legacy();
+    void index_native();
+    void advise_sequential(bool on) const;
+};
+
+#endif // SPIKE_DATASET_H
@@ -0,0 +1,34 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#ifndef TRAIN_POLICY_H
+#define TRAIN_POLICY_H
+
+#include <stdexcept>
+#include <string>
+
+// Learning rule of the reservoir. DFA and FA feed the output error back through W_fb,
+// NONE only trains the output layer.
+enum class Train_rule { DFA, FA, NONE };
+
+inline Train_rule parse_train_rule(const std::string& name) {
+    if (name == "DFA") return Train_rule::DFA;
+    if (name == "FA") return Train_rule::FA;
+    if (name == "NONE") return Train_rule::NONE;
+    throw std::runtime_error("Unknown train_mode: " + name);
+}
+
+// Modes of the run loop as compile-time constants (formerly the TRAIN_DFA, TRAIN_FA, TRAIN_PHASE,
+// TRAIN_ELIGIBLETRACE and REFRACTORY build macros). Core instantiates its run loop once per
+// combination and picks one at runtime, so disabled modes cost nothing inside the loop.
+template <Train_rule Rule, bool Phase, bool Eligibility_trace, bool Refractory>
+struct Train_policy {
+    static constexpr Train_rule rule = Rule;
+    static constexpr bool dfa = Rule == Train_rule::DFA;
+    static constexpr bool fa = Rule == Train_rule::FA;
+    static constexpr bool feedback = dfa || fa;     // reservoir events through W_fb
+    static constexpr bool phase = Phase;
+    static constexpr bool trace = Eligibility_trace;
+    static constexpr bool refractory = Refractory;
+};
+
+#endif // TRAIN_POLICY_H
@@ -0,0 +1,79 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#ifndef UPDATE_ACCUMULATOR_H
+#define UPDATE_ACCUMULATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Net +-step count of each synapse of a weight matrix, keyed by a 64-bit synapse index.
+// Only the synapses counted since the last clear are stored: an open addressing table points into
+// the list of counted synapses, so memory and applying follow the synapses touched by a batch
+// rather than the size of the matrix. The table grows on demand and clear() keeps it.
+// Written by one thread; disjoint slices of [0, size()) can be applied by different threads.
+class Update_accumulator {
+public:
+    inline void add(uint64_t k, int32_t n) {
+        if (2 * (entries.size() + 1) > slots.size()) grow();
+        size_t s = probe(k);
+        if (slots[s] == 0) {
+            entries.push_back({k, 0, static_cast<uint32_t>(s)});
+            slots[s] = static_cast<uint32_t>(entries.size());
+        }
+        entries[slots[s] - 1].count += n;
+    }
+
+    // Add the counts of other and clear them there
+    void merge(Update_accumulator& other) {
+        for (const Entry& e : other.entries) add(e.key, e.count);
+        other.clear();
+    }
+
+    // Number of synapses counted since the last clear
+    size_t size() const { return entries.size(); }
+
+    // Call f(k, n) for the non-zero counts of the counted synapses [begin, end),
+    // clear() once every slice is applied
+    template <typename F>
+    void apply(size_t begin, size_t end, F&& f) const {
+        for (size_t t = begin; t < end; ++t) {
+            if (entries[t].count != 0) f(entries[t].key, entries[t].count);
+        }
+    }
+
+    void clear() {
+        for (const Entry& e : entries) slots[e.slot] = 0;
+        entries.clear();
+    }
+
+private:
+    struct Entry {
+        uint64_t key;
+        int32_t count;
+        uint32_t slot;      // position in slots
+    };
+
+    // Slot of key k, or the empty slot where it goes
+    size_t probe(uint64_t k) const {
+        size_t mask = slots.size() - 1;
+        size_t s = static_cast<size_t>((k * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+        while (slots[s] != 0 && entries[slots[s] - 1].key != k) s = (s + 1) & mask;
+        return s;
+    }
+
+    // Double the table (a power of two, at most half full) and place the counted synapses again
+    void grow() {
+        slots.assign(slots.empty() ? 64 : 2 * slots.size(), 0);
+        for (size_t t = 0; t < entries.size(); ++t) {
+            size_t s = probe(entries[t].key);
+            slots[s] = static_cast<uint32_t>(t + 1);
+            entries[t].slot = static_cast<uint32_t>(s);
+        }
+    }
+
+    std::vector<Entry> entries;     // counted synapses in the order of their first count
+    std::vector<uint32_t> slots;    // 1 + index into entries, 0 if empty
+};
+
+#endif // UPDATE_ACCUMULATOR_H
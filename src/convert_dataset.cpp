@@ -0,0 +1,24 @@
+// Copyright contributors to the speakmin project
+// SPDX-License-Identifier: Apache-2.0
+#include <exception>
+#include <iostream>
+#include <string>
+#include "Spike_dataset.h"
+
+// Convert spike dataset files to the native format, e.g.
+//   convert_dataset test.bin test.smsd
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <input file> <output file>" << std::endl;
+        return 1;
+    }
+    try {
+        Spike_dataset dataset(argv[1]);
+        dataset.save_native(argv[2]);
+        std::cout << argv[1] << " -> " << argv[2] << ": " << dataset.size() << " entries" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}